@@ -23,11 +23,21 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include <FL/Fl_Highlight_Editor.H>
 #include <FL/Fl.H>
 
 #include "ts/scheme.h"
 #include "ts/scheme-private.h"
+#include "hi_image.h"
+#include "hi_keywords.h"
+#include "hi_linecache.h"
+#include "hi_literal.h"
+#include "hi_names.h"
+#include "hi_regex.h"
+#include "hi_scan.h"
+#include "hi_style.h"
+#include "hi_tokens.h"
 
 #undef cons
 #undef immutable_cons
@@ -42,13 +52,81 @@
 #if USE_POSIX_REGEX
 # include <sys/types.h>
 # include <regex.h>
+
+/* REG_STARTEND lets regexec() match text that isn't NUL terminated, directly inside the buffer */
+# ifdef REG_STARTEND
+#  define USE_REGEX_STARTEND 1
+# else
+#  define USE_REGEX_STARTEND 0
+# endif
+#endif
+
+#if USE_HIGHLIGHT_THREAD
+# include <pthread.h>
+# include <sched.h>
 #endif
 
+#define USE_REGEX (USE_POSIX_REGEX || USE_DFA_REGEX)
+
+/*
+ * Number of lines highlighted at once by idle callback. Edits needing more than this (large paste, opening block
+ * comment at the beginning of large file) are finished by the idle callback, if idle highlighting is enabled.
+ */
+#define IDLE_CHUNK_LINES 256
+
+/*
+ * Lines longer than *editor-max-line-length* (e.g. minified files) are re-highlighted on edit only LONG_LINE_WINDOW
+ * bytes before and after the edit and the cursor; see hi_lex_long_line().
+ */
+#define LONG_LINE_WINDOW (4 * 1024)
+
+/*
+ * Maximum size of text copied for background thread at once. Every edit throws away the job thread works on and
+ * copies the text again, so this keeps typing cheap no matter how big the file is.
+ */
+#define THREAD_SNAPSHOT_SIZE (1024 * 1024)
+
+/* smallest text for which highlighting the whole buffer at once is split between threads */
+#define PARALLEL_MIN_SIZE (256 * 1024)
+
+/* buffers reused between edits are freed after the edit if they grew larger than this (e.g. after large paste) */
+#define SCRATCH_KEEP_SIZE (256 * 1024)
+
+/* number of modes whose compiled contexts are kept after switching to another mode */
+#define MODE_CACHE_SIZE 8
+
+/*
+ * *editor-rule-budget* is the time regex rule can spend on every RULE_BUDGET_SIZE bytes it highlighted since rules
+ * were enabled. Time is checked after RULE_CHECK_STEPS bytes were matched (POSIX regex) or RULE_CHECK_MATCHES matches
+ * were found.
+ */
+#define RULE_BUDGET_SIZE   (64 * 1024)
+#define RULE_CHECK_STEPS   4096
+#define RULE_CHECK_MATCHES 256
+
+/* lines with literals of regex rule are matched together if they are closer than this; see HiRuleSpan */
+#define RULE_SPAN_GAP 256
+
+/* rules hi_parse() orders without allocating */
+#define RULE_ORDER_SIZE 64
+
 #define DEFAULT_FACE "default-face"
 #define STR_CMP(s1, s2) (strcmp((s1), (s2)) == 0)
 
 extern int FL_NORMAL_SIZE; /* default FLTK font size */
 
+static void hi_idle(void *data);
+
+#if USE_HIGHLIGHT_THREAD
+struct HiWorker;
+static void hi_worker_stop(Fl_Highlight_Editor_P *priv);
+# define PARSE_LOCK(priv)   if((priv)->worker) pthread_mutex_lock(&(priv)->worker->lock)
+# define PARSE_UNLOCK(priv) if((priv)->worker) pthread_mutex_unlock(&(priv)->worker->lock)
+#else
+# define PARSE_LOCK(priv)
+# define PARSE_UNLOCK(priv)
+#endif
+
 typedef Fl_Text_Display::Style_Table_Entry StyleTable;
 
 enum {
@@ -57,9 +135,60 @@ enum {
 	CONTEXT_TYPE_BLOCK,
 	CONTEXT_TYPE_REGEX,
 	CONTEXT_TYPE_EXACT,
+	CONTEXT_TYPE_KEYWORDS,
+	CONTEXT_TYPE_WORD_CHARS, /* not a context; adds word bytes for keyword contexts */
+	CONTEXT_TYPE_STRING,
+	CONTEXT_TYPE_NUMBER,
+	CONTEXT_TYPE_IDENTIFIER,
 	CONTEXT_TYPE_LAST  /* used to determine end of type list */
 };
 
+/* how contexts are applied; selected per mode with *editor-context-engine* */
+enum {
+	CONTEXT_ENGINE_OVERLAY,  /* every context is matched over the whole region, later ones painting over earlier */
+	CONTEXT_ENGINE_COMBINED  /* all contexts are one automaton; leftmost-longest match wins, like in lexer */
+};
+
+/*
+ * How much highlighting is done, chosen by size of the text with *editor-large-file-thresholds*; every tier does
+ * less than the one before it. Names are returned by (editor-highlight-tier).
+ */
+enum {
+	HI_TIER_FULL,     /* everything, with block states tracked across the whole buffer */
+	HI_TIER_VIEWPORT, /* only visible lines, as if no block was open before them */
+	HI_TIER_NO_REGEX, /* the same, without regex rules; combined engine is replaced with overlay one */
+	HI_TIER_PLAIN     /* nothing; text is shown in default face */
+};
+
+static const char *hi_tier_names[] = { "full", "viewport", "no-regex", "plain", NULL };
+
+#if USE_REGEX
+enum {
+	RX_EXTENDED = (1 << 0),
+	RX_ICASE    = (1 << 1),
+	RX_NEWLINE  = (1 << 2)
+};
+
+/*
+ * Compiled regex. Builtin engine is tried first and POSIX regex is used for patterns it can't handle (or if it was
+ * disabled), so only one of these is set.
+ */
+struct Regex {
+	char    *pattern;
+	/* one of these is in every match, so lines without them are skipped; see hi_regex_literals() */
+	char    *lits[HI_REGEX_MAX_LITERALS];
+	int      lit_len[HI_REGEX_MAX_LITERALS];
+	int      nlits;
+	bool     anchored; /* matches only at line starts; see hi_regex_line_anchored() */
+#if USE_DFA_REGEX
+	HiRegex *dfa;
+#endif
+#if USE_POSIX_REGEX
+	regex_t *posix;
+#endif
+};
+#endif
+
 /*
  * This is table where are are stored rules for syntax highlighting. Syntax highlighting is done
  * by applying a couple of strategies:
@@ -78,6 +207,17 @@ enum {
  *  4) to eol (end of line) matching - exact string is searched for and the whole line, up to the end, is painted. This
  *     is intended for line comments.
  *
+ *  5) keywords matching - text is split into words and every word found in the list is painted. This is what regex
+ *     like '\<(if|else|while)\>' does, but without regex, no matter how long the list is. Numbers and identifiers
+ *     are found while text is split.
+ *
+ *  6) string matching - like block, but ending token escaped with escape character doesn't end it, and string that
+ *     can't span lines ends with the line.
+ *
+ * Exact strings, to eol tokens and block markers of all contexts are compiled in single Aho-Corasick automaton, so
+ * all of them are found with one pass over the text. Likewise, keywords of all contexts are in single table (HiKeywords),
+ * so words are looked up once, whatever the number of keyword contexts.
+ *
  * When painting is started, we scan ContextTable and for every matched type, we paint with given character found
  * match position in StyleTable buffer. To understaind how this works, see Fl_Text_Display documentation and how syntax
  * highlighting was done.
@@ -88,20 +228,174 @@ struct ContextTable {
 	int pos;
 	/* FIXME: 'char' also can be used */
 	int type;
-	/* FIXME: only pointer to scheme symbol; will it be GC-ed at some point? */
+	/* copy of face name; contexts can outlive Scheme table they were created from (see HiCompiledMode) */
 	const char *face;
+	/* id of 'face' in Fl_Highlight_Editor_P::faces; -1 without face */
+	int face_id;
+	/* lexer state bit for contexts spanning multiple lines (blocks); 0 if context does not carry state */
+	unsigned int state;
+	/* pattern ids of exact string or block markers inside literal matcher; filled in load_context_table() */
+	int literal[2];
+	/* regex rule ran over its time budget and is not matched anymore; see hi_disable_rules() */
+	bool disabled;
+	/* bytes of highlighted regions regex rule was matched on and how many of them its literals skipped */
+	long prof_bytes, prof_skipped;
+	/* time (in microseconds) regex rule took and bytes it was matched on since rules were enabled; see hi_parse() */
+	long long budget_spent;
+	long budget_bytes;
 
 	union {
-#if USE_POSIX_REGEX
-		regex_t    *rx;
+#if USE_REGEX
+		Regex      *rx;
 #endif
 		const char *block[2];
 		const char *exact;
+		int         keywords; /* keyword, number or identifier group inside HiKeywords */
+
+		struct {
+			const char *delim;
+			int         escape; /* escape byte or -1 */
+			bool        line;   /* string can't span lines, unless newline is escaped */
+		} string;
 	} object;
 
 	ContextTable *next, *last;
 };
 
+/*
+ * Compiled contexts of a mode, kept when another mode is loaded, so switching back (e.g. opening file of the same
+ * type again) doesn't compile every pattern again. Mode is found by its name (*editor-current-mode*) and hash of its
+ * rules and engine; if only the hash differs, patterns of unchanged regex rules are taken from it instead of being
+ * compiled. Fields are the same as in Fl_Highlight_Editor_P, which swaps them with its own.
+ */
+struct HiCompiledMode {
+	char         *mode;
+	unsigned int  hash;
+
+	ContextTable *ctable;
+	HiLiteral    *literals;
+	HiKeywords   *keywords;
+	HiNames       faces;
+	int           context_states;
+	int           context_engine;
+#if USE_DFA_REGEX
+	HiRegex       *combined;
+	ContextTable **combined_ctx;
+#endif
+
+	/* regex contexts by pattern, for taking their compiled patterns; see index_regexes() */
+	HiNames        patterns;
+	ContextTable **pattern_ctx;
+
+	HiCompiledMode *next;
+
+	HiCompiledMode(const char *m, unsigned int h);
+	~HiCompiledMode();
+
+#if USE_REGEX
+	void   index_regexes(void);
+	Regex *take_regex(const char *pattern);
+#endif
+};
+
+/* regex rule disabled because it ran over *editor-rule-budget* */
+struct HiRuleDiag {
+	ContextTable *ctx;
+	char *mode, *rule, *face;
+	int   ms, len;  /* time it took on region of 'len' bytes */
+	HiRuleDiag *next;
+};
+
+static void free_rule_diags(HiRuleDiag *d) {
+	HiRuleDiag *nx;
+
+	for(; d; d = nx) {
+		nx = d->next;
+		free(d->mode);
+		free(d->rule);
+		free(d->face);
+		delete d;
+	}
+}
+
+/*
+ * Matching state hi_parse() changes while it runs. UI thread uses the one from Fl_Highlight_Editor_P; every other
+ * thread highlighting at the same time needs its own, with copies of regex automatons (see hi_scratch_init()).
+ */
+struct HiScratch {
+	HiLiteralHits hits;
+	HiLiteralHits words;    /* keywords found by HiKeywords::scan() */
+#if USE_DFA_REGEX
+	HiRegex **dfa;      /* for every regex context with builtin engine, in ctable order; NULL to use context's own */
+	int       ndfa;
+	HiRegex  *combined; /* NULL to use Fl_Highlight_Editor_P::combined */
+#endif
+#if USE_POSIX_REGEX && !USE_REGEX_STARTEND
+	char *line;         /* regexec() needs NUL terminated line, so it is copied here */
+	int   line_size;
+#endif
+	HiRuleDiag *overrun; /* rules that ran over budget, until hi_disable_rules() disables them */
+
+	HiScratch();
+	~HiScratch();
+};
+
+HiScratch::HiScratch() {
+#if USE_DFA_REGEX
+	dfa      = NULL;
+	ndfa     = 0;
+	combined = NULL;
+#endif
+#if USE_POSIX_REGEX && !USE_REGEX_STARTEND
+	line      = NULL;
+	line_size = 0;
+#endif
+	overrun = NULL;
+}
+
+HiScratch::~HiScratch() {
+#if USE_POSIX_REGEX && !USE_REGEX_STARTEND
+	delete [] line;
+#endif
+	free_rule_diags(overrun);
+}
+
+/*
+ * Copy of styles Fl_Text_Display draws from. It has no modify callbacks or undo, so it is changed directly, without
+ * copies of deleted text Fl_Text_Buffer::replace() and remove() make for callbacks.
+ */
+struct HiStyleBuffer : public Fl_Text_Buffer {
+	HiStyleBuffer(int sz) : Fl_Text_Buffer(sz) { canUndo(0); }
+
+	/* insert 'n' default styles at 'pos' */
+	void insert_default(int pos, int n) {
+		static char chunk[257];
+		if(!chunk[0]) memset(chunk, 'A', sizeof(chunk) - 1);
+
+		if(n < (int)sizeof(chunk)) {
+			insert_(pos, chunk + sizeof(chunk) - 1 - n);
+			return;
+		}
+
+		/* inserting in chunks would grow the gap every time */
+		char *style = new char[n + 1];
+		memset(style, 'A', n);
+		style[n] = '\0';
+		insert_(pos, style);
+		delete [] style;
+	}
+
+	void remove_styles(int start, int end) { remove_(start, end); }
+
+	/* overwrite styles of [start, end) with those from 'runs', in place */
+	void copy_from(HiStyleRuns *runs, int start, int end) {
+		int gap = (start < mGapStart && end > mGapStart) ? mGapStart : end;
+
+		runs->get(start, gap - start, address(start));
+		if(gap < end) runs->get(gap, end - gap, address(gap));
+	}
+};
+
 struct Fl_Highlight_Editor_P {
 	scheme *scm;
 	char   *script_path;
@@ -110,13 +404,95 @@ struct Fl_Highlight_Editor_P {
 
 	Fl_Highlight_Editor *self; /* for doing redisplay and buffer() access from hi_update() callback */
 
-	Fl_Text_Buffer *stylebuf;
+	/*
+	 * Style of every character as runs of the same style. Fl_Text_Display reads styles from 'stylebuf', so it is
+	 * kept the same length as text, but ranges in 'stale' are copied to it only when they are about to be drawn.
+	 * In HI_TIER_PLAIN there is no 'stylebuf' (see hi_display_styles()).
+	 */
+	HiStyleRuns     styles;
+	HiRanges        stale;
+	HiRanges        changed;      /* spans store_styles() changed; reused */
+	int             redrawn_lines; /* lines redrawn because their styles changed since the last edit */
+	HiStyleBuffer  *stylebuf;
 	StyleTable     *styletable;
 	ContextTable   *ctable;
 
+	HiLiteral      *literals;     /* literal tokens of all contexts in ctable */
+	HiKeywords     *keywords;     /* keywords of all contexts in ctable; NULL if there are none */
+	HiNames        faces;         /* face names used by contexts in ctable */
+
+	/* key of ctable, compiled contexts of previously used modes and the old version of the mode being loaded */
+	char           *ctable_mode;
+	unsigned int    ctable_hash;
+	HiCompiledMode *modes;
+	HiCompiledMode *reuse;
+
+	/* mode whose image is written once its contexts are compiled, and mode files it was loaded from */
+	char           *image_mode;
+	char           *image_path;
+	char          **image_sources;
+	int             image_nsources;
+	HiScratch      scratch;       /* reused between hi_parse() calls */
+
+	/* reused between edits, so typing doesn't allocate; see hi_reserve() */
+	char         *style_tmp;      /* styles of re-highlighted lines */
+	int           style_tmp_size;
+	unsigned int *eol_tmp;        /* their line states */
+	int           eol_tmp_size;
+	char         *gap_line;       /* line split by the gap of Fl_Text_Buffer */
+	int           gap_line_size;
+
 	int styletable_size; /* size of styletable */
 	int styletable_last; /* last item in styletable */
 
+	int context_states;  /* number of lexer state bits given to multi-line contexts */
+	int context_engine;  /* CONTEXT_ENGINE_XXX */
+
+	int         rule_budget; /* *editor-rule-budget*; 0 if rules can run as long as they need */
+	int         max_line_length; /* *editor-max-line-length*; 0 if lines of any length are re-lexed whole */
+	int         tier;            /* HI_TIER_XXX of the buffer */
+	bool        loading;         /* inside loadfile(); nothing is highlighted until the file is in the buffer */
+	HiRuleDiag *diagnostics; /* rules disabled since the buffer or contexts were changed */
+	HiLineCache line_cache;  /* styles of recently highlighted lines; see *editor-line-cache-size* */
+
+#if USE_DFA_REGEX
+	/* for CONTEXT_ENGINE_COMBINED, all contexts compiled together and the context of each pattern in it */
+	HiRegex       *combined;
+	ContextTable **combined_ctx;
+#endif
+
+	/*
+	 * Lexer state at the end of each line of the buffer, where set bits are multi-line contexts still open at
+	 * that point. hi_update() uses it to re-lex only until the new line state matches the cached one.
+	 */
+	unsigned int *line_state;
+	int line_state_size; /* size of line_state */
+	int line_state_last; /* number of lines in line_state */
+
+	/* known line start and its line number, so we don't count lines from the buffer start on every edit */
+	int line_hint_pos, line_hint_line;
+
+	/*
+	 * Lines before 'lexed_line' (starting at 'lexed_pos') have final styles and states; the rest is highlighted by
+	 * idle callback, where 'idle_budget' is the time in ms it can spend on every call. 'spec_line' is the first
+	 * visible line if visible lines were highlighted ahead of 'lexed_line', assuming no block was open before them.
+	 */
+	int lexed_line, lexed_pos;
+	int spec_line;
+	int idle_budget;
+
+	/* increased on every buffer change; highlighting done by background thread for older revision is discarded */
+	unsigned int revision;
+
+	/* begin_batch() nesting; inside a batch, edits only add text to be highlighted to 'dirty' */
+	int      batch;
+	HiRanges dirty;
+
+#if USE_HIGHLIGHT_THREAD
+	bool      use_thread; /* *editor-highlight-thread* */
+	HiWorker *worker;
+#endif
+
 	Fl_Highlight_Editor_P();
 
 	int  push_style(int color, int font, int size);
@@ -124,14 +500,81 @@ struct Fl_Highlight_Editor_P {
 	void clear_styles();
 
 	void push_context(scheme *s, int type, pointer content, const char *face);
+	void take_state(ContextTable *t, const char *token);
 	void clear_contexts();
+	void enable_rules();
+
+	void swap_contexts(HiCompiledMode *m);
+	void stash_contexts();
+	HiCompiledMode *unlink_mode(const char *mode, unsigned int hash, bool match_hash);
+	void cache_mode(HiCompiledMode *m);
+	void clear_modes();
+
+	pointer load_mode_image(scheme *s, const char *mode, const char *path);
+	void prepare_mode_image(scheme *s, const char *mode, const char *path, pointer sources);
+	void save_mode_image();
+	void clear_mode_image();
+
+	void resize_line_states(int nlines);
+	void shift_line_states(int line, int ndeleted, int ninserted);
+	void clear_line_states();
+
+	void visible_lines(int *start, int *nlines);
+
+	void visible_range(int *start, int *end);
+	void visible_chars(int *start, int *end);
+
+	void store_styles(int pos, int len, const char *style);
+	void sync_visible_styles();
+	void trim_scratch();
+};
+
+#if USE_HIGHLIGHT_THREAD
+/* chunk of lines highlighted by background thread, waiting to be published by hi_publish() */
+struct HiResult {
+	unsigned int revision;
+	int pos, len;        /* highlighted region of the buffer */
+	int line, nlines;
+	char         *style;
+	unsigned int *eol;   /* states at the end of each line */
+	HiResult     *next;
+};
+
+/*
+ * Background highlighting thread. It highlights a copy of the text (job) taken at some buffer revision and sends
+ * results back to the UI thread with Fl::awake(). Because it shares compiled contexts with the widget, 'lock' is
+ * held by the thread while it runs hi_parse() and by UI thread when it does the same or changes contexts.
+ */
+struct HiWorker {
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+
+	Fl_Highlight_Editor_P *priv; /* NULL when widget is gone */
+	bool quit;
+	int  refs;                   /* thread itself and pending hi_publish() call */
+
+	unsigned int revision;       /* the latest buffer revision */
+
+	/*
+	 * Job: text starting at buffer position 'pos' and line 'line', 'done' characters of it are highlighted. If it
+	 * goes to the end of the buffer, 'last' is the number of lines in the buffer.
+	 */
+	char        *text;
+	int          pos, line, len, done, last;
+	bool         at_end;
+	unsigned int state, job_revision;
+
+	HiResult *results, *results_last;
+	bool      awake_pending;
 };
+#endif
 
 /*
  * regcomp() with ability to check if pattern starts/ends with '|'. Without checking, this could cause
  * infinite loop.
  */
-#if USE_POSIX_REGEX_CHECK
+#if USE_POSIX_REGEX && USE_POSIX_REGEX_CHECK
 static int regcomp_safe(regex_t *preg, const char *regex, int cflags) {
 	int l = strlen(regex);
 
@@ -144,6 +587,77 @@ static int regcomp_safe(regex_t *preg, const char *regex, int cflags) {
 # define regcomp_safe regcomp
 #endif
 
+#if USE_REGEX
+static void regex_free(Regex *rx) {
+	if(!rx) return;
+
+	free(rx->pattern);
+	for(int i = 0; i < rx->nlits; i++)
+		free(rx->lits[i]);
+#if USE_DFA_REGEX
+	hi_regex_free(rx->dfa);
+#endif
+#if USE_POSIX_REGEX
+	if(rx->posix) {
+		regfree(rx->posix);
+		free(rx->posix);
+	}
+#endif
+	free(rx);
+}
+
+/* literals for rules matched line by line; other patterns are matched as they are */
+static void regex_find_literals(Regex *rx, int flags) {
+	if((flags & RX_EXTENDED) && (flags & RX_NEWLINE)) {
+		rx->nlits = hi_regex_literals(rx->pattern, HI_REGEX_NEWLINE | ((flags & RX_ICASE) ? HI_REGEX_ICASE : 0),
+									  rx->lits, rx->lit_len);
+		rx->anchored = hi_regex_line_anchored(rx->pattern, HI_REGEX_NEWLINE);
+	}
+}
+
+/* 'flags' are RX_XXX values; returns NULL if pattern is not valid */
+static Regex *regex_compile(const char *pattern, int flags) {
+	Regex *rx = (Regex*)calloc(1, sizeof(Regex));
+	rx->pattern = strdup(pattern);
+	regex_find_literals(rx, flags);
+
+#if USE_DFA_REGEX
+	/* builtin engine understands only extended syntax */
+	if(flags & RX_EXTENDED) {
+		rx->dfa = hi_regex_compile(pattern, ((flags & RX_ICASE) ? HI_REGEX_ICASE : 0) |
+										   ((flags & RX_NEWLINE) ? HI_REGEX_NEWLINE : 0));
+		if(rx->dfa) return rx;
+	}
+#endif
+
+#if USE_POSIX_REGEX
+	int cflags = ((flags & RX_EXTENDED) ? REG_EXTENDED : 0) |
+				 ((flags & RX_ICASE) ? REG_ICASE : 0) |
+				 ((flags & RX_NEWLINE) ? REG_NEWLINE : 0);
+
+	rx->posix = (regex_t*)malloc(sizeof(regex_t));
+	if(regcomp_safe(rx->posix, pattern, cflags) == 0) return rx;
+
+	free(rx->posix);
+	rx->posix = NULL;
+#endif
+
+	regex_free(rx);
+	return NULL;
+}
+
+/* check if 'str' matches anywhere */
+static bool regex_match(Regex *rx, const char *str) {
+#if USE_DFA_REGEX
+	if(rx->dfa) return hi_regex_test(rx->dfa, str, strlen(str));
+#endif
+#if USE_POSIX_REGEX
+	if(rx->posix) return regexec(rx->posix, str, (size_t)0, NULL, 0) != REG_NOMATCH;
+#endif
+	return false;
+}
+#endif /* USE_REGEX */
+
 /* first some scheme functions we export */
 
 #define SCHEME_RET_IF_FAIL(scm, expr, str)      \
@@ -278,10 +792,9 @@ INLINE static pointer scheme_run_hook(scheme *sc, const char *hook, pointer args
 }
 
 /* regex */
-#if USE_POSIX_REGEX
+#if USE_REGEX
 INLINE static void _rx_free(void *r) {
-	regex_t *rx = (regex_t*)r;
-	regfree(rx);
+	regex_free((Regex*)r);
 }
 
 static pointer _rx_compile(scheme *s, pointer args) {
@@ -313,17 +826,17 @@ static pointer _rx_compile(scheme *s, pointer args) {
 
 			/* tinyscheme always make symbols as lowercase */
 			if(STR_CMP(sym, "rx_extended")) {
-			  flags |= REG_EXTENDED;
+			  flags |= RX_EXTENDED;
 			  continue;
 			}
 
 			if(STR_CMP(sym, "rx_ignore_case")) {
-			  flags |= REG_ICASE;
+			  flags |= RX_ICASE;
 			  continue;
 			}
 
 			if(STR_CMP(sym, "rx_newline")) {
-			  flags |= REG_NEWLINE;
+			  flags |= RX_NEWLINE;
 			  continue;
 			}
 
@@ -331,12 +844,8 @@ static pointer _rx_compile(scheme *s, pointer args) {
 		}
 	}
 
-	regex_t *rx = (regex_t*)malloc(sizeof(regex_t));
-
-	if(regcomp_safe(rx, pattern, flags) != 0) {
-		free(rx);
-		return s->F;
-	}
+	Regex *rx = regex_compile(pattern, flags);
+	if(!rx) return s->F;
 
 	return s->vptr->mk_opaque(s, "REGEX", rx, _rx_free);
 }
@@ -358,20 +867,20 @@ static pointer _rx_match(scheme *s, pointer args) {
 	SCHEME_RET_IF_FAIL(s, _rx_type(s, args) == s->T, "Expected regex object as first argument.");
 
 	pointer arg;
-	regex_t *rx;
+	Regex *rx;
 	char *str;
 
 	arg = s->vptr->pair_car(args);
-	rx = (regex_t*)s->vptr->opaquevalue(arg);
+	rx = (Regex*)s->vptr->opaquevalue(arg);
 
 	args = s->vptr->pair_cdr(args);
 	arg = s->vptr->pair_car(args);
 	SCHEME_RET_IF_FAIL(s, s->vptr->is_string(arg), "Expected string object as second argument.");
 
 	str = s->vptr->string_value(arg);
-	return regexec(rx, str, (size_t)0, NULL, 0) == REG_NOMATCH ? s->F : s->T;
+	return regex_match(rx, str) ? s->T : s->F;
 }
-#endif /* USE_POSIX_REGEX */
+#endif /* USE_REGEX */
 
 static pointer _file_exists(scheme *s, pointer args) {
 	pointer arg = s->vptr->pair_car(args);
@@ -423,6 +932,43 @@ static pointer _goto_char(scheme *s, pointer args) {
 	return s->T;
 }
 
+static pointer _insert(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	pointer arg = s->vptr->pair_car(args);
+
+	SCHEME_RET_IF_FAIL(s, arg != s->NIL && s->vptr->is_string(arg),
+					   "Expected string as first argument.");
+
+	if(!priv->self->buffer()) return s->F;
+
+	priv->self->insert(s->vptr->string_value(arg));
+	return s->T;
+}
+
+static pointer _delete_region(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	pointer arg = s->vptr->pair_car(args);
+	int start;
+
+	SCHEME_RET_IF_FAIL(s, arg != s->NIL && s->vptr->is_integer(arg),
+					   "Expected number as first argument.");
+
+	start = s->vptr->ivalue(arg);
+	args = s->vptr->pair_cdr(args);
+	arg = s->vptr->pair_car(args);
+
+	SCHEME_RET_IF_FAIL(s, arg != s->NIL && s->vptr->is_integer(arg),
+					   "Expected number as second argument.");
+
+	Fl_Text_Buffer *b = priv->self->buffer();
+	if(!b) return s->F;
+
+	b->remove(start, s->vptr->ivalue(arg));
+	return s->T;
+}
+
 static pointer _beginning_of_line(scheme *s, pointer args) {
 	ASSERT(s->ext_data != NULL);
 	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
@@ -606,15 +1152,142 @@ static pointer _editor_dump_style_buf(scheme *s, pointer args) {
 	ASSERT(s->ext_data != NULL);
 	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
 
-	pointer ret;
-	char *txt = priv->stylebuf ? priv->stylebuf->text() : NULL;
-	const char *p = txt ? (const char*)txt : "";
-	ret = s->vptr->mk_string(s, p);
-	if(txt) free(txt);
+	int  len  = priv->styles.length;
+	char *txt = new char[len + 1];
+
+	priv->styles.get(0, len, txt);
+	txt[len] = '\0';
+
+	pointer ret = s->vptr->mk_string(s, txt);
+	delete [] txt;
+	return ret;
+}
+
+static pointer _editor_begin_batch(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+
+	priv->self->begin_batch();
+	return s->T;
+}
+
+static pointer _editor_end_batch(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+
+	priv->self->end_batch();
+	return s->T;
+}
+
+static pointer _editor_redrawn_lines(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	return s->vptr->mk_integer(s, priv->redrawn_lines);
+}
+
+static pointer _editor_rule_diagnostics(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	pointer ret = s->NIL, v;
+
+	/* background thread can disable rules while it highlights */
+	PARSE_LOCK(priv);
+	for(HiRuleDiag *d = priv->diagnostics; d; d = d->next) {
+		v = s->vptr->mk_vector(s, 5);
+		s->vptr->set_vector_elem(v, 0, d->mode ? s->vptr->mk_string(s, d->mode) : s->F);
+		s->vptr->set_vector_elem(v, 1, s->vptr->mk_string(s, d->rule));
+		s->vptr->set_vector_elem(v, 2, d->face ? s->vptr->mk_symbol(s, d->face) : s->F);
+		s->vptr->set_vector_elem(v, 3, s->vptr->mk_integer(s, d->ms));
+		s->vptr->set_vector_elem(v, 4, s->vptr->mk_integer(s, d->len));
+
+		ret = s->vptr->cons(s, v, ret);
+	}
+	PARSE_UNLOCK(priv);
 
+	/* diagnostics are kept newest first, so the list is oldest first */
 	return ret;
 }
 
+static pointer _editor_highlight_tier(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	return s->vptr->mk_symbol(s, hi_tier_names[priv->tier]);
+}
+
+static pointer _editor_line_cache_stats(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	HiLineCache *c = &priv->line_cache;
+	pointer v = s->vptr->mk_vector(s, 5);
+
+	PARSE_LOCK(priv);
+	s->vptr->set_vector_elem(v, 0, s->vptr->mk_integer(s, c->hits));
+	s->vptr->set_vector_elem(v, 1, s->vptr->mk_integer(s, c->misses));
+	s->vptr->set_vector_elem(v, 2, s->vptr->mk_real(s, (c->hits + c->misses) ? (double)c->hits / (c->hits + c->misses) : 0));
+	s->vptr->set_vector_elem(v, 3, s->vptr->mk_integer(s, c->nlines));
+	s->vptr->set_vector_elem(v, 4, s->vptr->mk_integer(s, c->memory));
+	PARSE_UNLOCK(priv);
+
+	return v;
+}
+
+static pointer _editor_rule_profile(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	pointer ret = s->NIL, v, lits;
+
+#if USE_REGEX
+	for(ContextTable *it = priv->ctable; it; it = it->next) {
+		if(it->type != CONTEXT_TYPE_REGEX) continue;
+
+		Regex *rx = it->object.rx;
+
+		lits = s->NIL;
+		for(int i = rx->nlits - 1; i >= 0; i--)
+			lits = s->vptr->cons(s, s->vptr->mk_string(s, rx->lits[i]), lits);
+
+		v = s->vptr->mk_vector(s, 5);
+		s->vptr->set_vector_elem(v, 0, s->vptr->mk_string(s, rx->pattern));
+		s->vptr->set_vector_elem(v, 1, it->face ? s->vptr->mk_symbol(s, it->face) : s->F);
+		s->vptr->set_vector_elem(v, 2, lits);
+		s->vptr->set_vector_elem(v, 3, s->vptr->mk_integer(s, it->prof_bytes));
+		s->vptr->set_vector_elem(v, 4, s->vptr->mk_real(s, it->prof_bytes ? (double)it->prof_skipped / it->prof_bytes : 0));
+
+		ret = s->vptr->cons(s, v, ret);
+	}
+#endif
+
+	return scheme_reverse_in_place(s, s->NIL, ret);
+}
+
+static pointer _editor_load_mode_image(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	pointer mode = s->vptr->pair_car(args);
+
+	SCHEME_RET_IF_FAIL(s, mode != s->NIL && s->vptr->is_string(mode), "Expected mode name as first argument.");
+	args = s->vptr->pair_cdr(args);
+	pointer path = s->vptr->pair_car(args);
+	SCHEME_RET_IF_FAIL(s, path != s->NIL && s->vptr->is_string(path), "Expected mode file as second argument.");
+
+	return priv->load_mode_image(s, s->vptr->string_value(mode), s->vptr->string_value(path));
+}
+
+static pointer _editor_prepare_mode_image(scheme *s, pointer args) {
+	ASSERT(s->ext_data != NULL);
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)(s->ext_data);
+	pointer mode = s->vptr->pair_car(args);
+
+	SCHEME_RET_IF_FAIL(s, mode != s->NIL && s->vptr->is_string(mode), "Expected mode name as first argument.");
+	args = s->vptr->pair_cdr(args);
+	pointer path = s->vptr->pair_car(args);
+	SCHEME_RET_IF_FAIL(s, path != s->NIL && s->vptr->is_string(path), "Expected mode file as second argument.");
+
+	priv->prepare_mode_image(s, s->vptr->string_value(mode), s->vptr->string_value(path),
+							 s->vptr->pair_car(s->vptr->pair_cdr(args)));
+	return s->T;
+}
+
 /* export this symbols to intepreter */
 static void init_scheme_prelude(scheme *s, Fl_Highlight_Editor_P *priv) {
 	/* So functions can access buffer(), self and etc. Accessed with 's->ext_data'. */
@@ -624,7 +1297,7 @@ static void init_scheme_prelude(scheme *s, Fl_Highlight_Editor_P *priv) {
 	SCHEME_DEFINE2(s, _file_exists, "file-exists?", "Check if given file is accessible.");
 	SCHEME_DEFINE2(s, _system, "system", "Run external command.");
 
-#if USE_POSIX_REGEX
+#if USE_REGEX
 	SCHEME_DEFINE2(s, _rx_compile, "regex-compile",
 				   "Compile regular expression into binary (and fast object). If fails, returns #f.");
 	SCHEME_DEFINE2(s, _rx_type, "regex?",
@@ -640,6 +1313,8 @@ static void init_scheme_prelude(scheme *s, Fl_Highlight_Editor_P *priv) {
 	SCHEME_DEFINE2(s, _goto_char, "goto-char", "Move cursor to given position.");
 	SCHEME_DEFINE2(s, _beginning_of_line, "beginning-of-line", "Move cursor to beginning of line.");
 	SCHEME_DEFINE2(s, _end_of_line, "end-of-line", "Move cursor to end of line.");
+	SCHEME_DEFINE2(s, _insert, "insert", "Insert string at cursor position.");
+	SCHEME_DEFINE2(s, _delete_region, "delete-region", "Delete text between given positions.");
 	SCHEME_DEFINE2(s, _set_tab_width, "set-tab-width", "Set TAB width.");
 	SCHEME_DEFINE2(s, _get_tab_width, "get-tab-width", "Get TAB width. If buffer not available, returns -1.");
 	SCHEME_DEFINE2(s, _set_tab_expand, "set-tab-expand", "Replace TAB with spaces. Uses TAB width.");
@@ -649,10 +1324,27 @@ static void init_scheme_prelude(scheme *s, Fl_Highlight_Editor_P *priv) {
 	SCHEME_DEFINE2(s, _editor_set_cursor_color, "editor-set-cursor-color", "Set cursor color.");
 	SCHEME_DEFINE2(s, _editor_set_cursor_shape, "editor-set-cursor-shape", "Set cursor shape.");
 	SCHEME_DEFINE2(s, _editor_set_fltk_font_face, "editor-set-fltk-font-face", "Change FLTK font by assigning it font name.");
+	SCHEME_DEFINE2(s, _editor_begin_batch, "editor-begin-batch",
+				   "Start batch of edits; changed text is highlighted once, by matching editor-end-batch.");
+	SCHEME_DEFINE2(s, _editor_end_batch, "editor-end-batch", "End batch of edits and highlight text changed inside it.");
 
 	/* for debugging */
 	SCHEME_DEFINE2(s, _editor_dump_style_table, "editor-dump-style-table", "Returns internal copy of style table. For debugging purposes.");
 	SCHEME_DEFINE2(s, _editor_dump_style_buf, "editor-dump-style-buffer", "Returns internal copy of style buffer. For debugging purposes.");
+	SCHEME_DEFINE2(s, _editor_redrawn_lines, "editor-redrawn-lines",
+				   "Number of lines redrawn since the last edit because their highlighting changed. For profiling.");
+	SCHEME_DEFINE2(s, _editor_rule_diagnostics, "editor-rule-diagnostics",
+				   "List of regex rules disabled because they ran over *editor-rule-budget*, as #(mode rule face ms bytes) vectors.");
+	SCHEME_DEFINE2(s, _editor_rule_profile, "editor-rule-profile",
+				   "List of regex rules of the current mode as #(rule face literals bytes skipped) vectors; 'skipped' is the part of 'bytes' (0 to 1) without any of 'literals', which was not matched. For profiling.");
+	SCHEME_DEFINE2(s, _editor_highlight_tier, "editor-highlight-tier",
+				   "How much of the buffer is highlighted: full, viewport, no-regex or plain; see *editor-large-file-thresholds*.");
+	SCHEME_DEFINE2(s, _editor_line_cache_stats, "editor-line-cache-stats",
+				   "Line cache statistics as #(hits misses hit-rate lines bytes) vector; see *editor-line-cache-size*. For profiling.");
+	SCHEME_DEFINE2(s, _editor_load_mode_image, "editor-load-mode-image",
+				   "Load compiled rules of mode from image next to its file. Returns list of context table, engine and mode files or #f if image is missing or out of date.");
+	SCHEME_DEFINE2(s, _editor_prepare_mode_image, "editor-prepare-mode-image",
+				   "Write image of mode loaded from given file once its rules are compiled. Third argument is list of mode files it was loaded from.");
 }
 
 /* core widget code */
@@ -664,7 +1356,44 @@ Fl_Highlight_Editor_P::Fl_Highlight_Editor_P() {
 	stylebuf    = NULL;
 	styletable  = NULL;
 	ctable      = NULL;
+	literals    = NULL;
+	keywords    = NULL;
+	ctable_mode = NULL;
+	ctable_hash = 0;
+	modes       = NULL;
+	reuse       = NULL;
+	image_mode  = image_path = NULL;
+	image_sources  = NULL;
+	image_nsources = 0;
 	styletable_size = styletable_last = 0;
+	style_tmp   = NULL;
+	eol_tmp     = NULL;
+	gap_line    = NULL;
+	style_tmp_size = eol_tmp_size = gap_line_size = 0;
+	redrawn_lines = 0;
+	context_states = 0;
+	context_engine = CONTEXT_ENGINE_OVERLAY;
+	rule_budget = 0;
+	max_line_length = 0;
+	tier = HI_TIER_FULL;
+	loading = false;
+	diagnostics = NULL;
+#if USE_DFA_REGEX
+	combined     = NULL;
+	combined_ctx = NULL;
+#endif
+	line_state  = NULL;
+	line_state_size = line_state_last = 0;
+	line_hint_pos = line_hint_line = 0;
+	lexed_line  = lexed_pos = 0;
+	spec_line   = -1;
+	idle_budget = 0;
+	revision    = 0;
+	batch       = 0;
+#if USE_HIGHLIGHT_THREAD
+	use_thread  = false;
+	worker      = NULL;
+#endif
 	loaded_context_and_faces = false;
 	update_cb_added = false;
 	/* initial 'A' - plain */
@@ -714,6 +1443,15 @@ void Fl_Highlight_Editor_P::clear_styles(void) {
 	styletable_last = styletable_size = 0;
 }
 
+/* lexer state bit for context spanning lines */
+void Fl_Highlight_Editor_P::take_state(ContextTable *t, const char *token) {
+	/* contexts past the number of bits we have will be painted, but not tracked across lines */
+	if(context_states < (int)(sizeof(t->state) * CHAR_BIT))
+		t->state = 1U << context_states++;
+	else
+		printf("Warning: too many multi-line contexts, '%s' will not be tracked across lines\n", token);
+}
+
 #define FREE_AND_RETURN(o)	\
 	delete o;			\
 	return;
@@ -723,8 +1461,14 @@ void Fl_Highlight_Editor_P::push_context(scheme *s, int type, pointer content, c
 	/* chr and pos are re-populated in load_face_table() */
 	t->chr = 'A';
 	t->pos = 0;
-	t->face = face;
+	t->face = NULL;
+	t->face_id = -1;
 	t->type = type;
+	t->state = 0;
+	t->literal[0] = t->literal[1] = -1;
+	t->disabled = false;
+	t->prof_bytes = t->prof_skipped = 0;
+	t->budget_spent = t->budget_bytes = 0;
 	t->last = t->next = NULL;
 
 	switch(type) {
@@ -732,18 +1476,19 @@ void Fl_Highlight_Editor_P::push_context(scheme *s, int type, pointer content, c
 		case CONTEXT_TYPE_LAST:
 			break;
 		case CONTEXT_TYPE_REGEX: {
-#if USE_POSIX_REGEX
+#if USE_REGEX
 			if(!s->vptr->is_string(content)) {
 				puts("Pattern must be a string");
 				FREE_AND_RETURN(t);
 			}
 
-			regex_t    *rx = (regex_t*)malloc(sizeof(regex_t));
 			const char *p  = (const char*)s->vptr->string_value(content);
+			Regex      *rx = reuse ? reuse->take_regex(p) : NULL;
 
-			if(regcomp_safe(rx, p, REG_EXTENDED | REG_NEWLINE) != 0) {
+			if(!rx) rx = regex_compile(p, RX_EXTENDED | RX_NEWLINE);
+
+			if(!rx) {
 				printf("Failed to compile pattern '%s'\n", p);
-				free(rx);
 				FREE_AND_RETURN(t);
 			}
 
@@ -759,8 +1504,7 @@ void Fl_Highlight_Editor_P::push_context(scheme *s, int type, pointer content, c
 				FREE_AND_RETURN(t);
 			}
 
-			/* FIXME: strdup()? */
-			t->object.exact = (const char*)s->vptr->string_value(content);
+			t->object.exact = strdup(s->vptr->string_value(content));
 			break;
 		}
 
@@ -778,9 +1522,84 @@ void Fl_Highlight_Editor_P::push_context(scheme *s, int type, pointer content, c
 				FREE_AND_RETURN(t);
 			}
 
-			/* FIXME: strdup()? */
-			t->object.block[0] = s->vptr->string_value(start);
-			t->object.block[1] = s->vptr->string_value(end);
+			t->object.block[0] = strdup(s->vptr->string_value(start));
+			t->object.block[1] = strdup(s->vptr->string_value(end));
+			take_state(t, t->object.block[0]);
+			break;
+		}
+
+		case CONTEXT_TYPE_STRING: {
+			/* "\"" or ("\"" [escape [single-line]]), where escape is one character string or #f; backslash by default */
+			pointer d = content, e = NULL, l = s->NIL;
+
+			if(s->vptr->is_pair(content)) {
+				d = s->vptr->pair_car(content);
+				content = s->vptr->pair_cdr(content);
+
+				if(s->vptr->is_pair(content)) {
+					e = s->vptr->pair_car(content);
+					l = s->vptr->pair_cdr(content);
+					l = s->vptr->is_pair(l) ? s->vptr->pair_car(l) : s->NIL;
+				}
+			}
+
+			if(!s->vptr->is_string(d) || !s->vptr->string_value(d)[0]) {
+				puts("String delimiter must be a non-empty string");
+				FREE_AND_RETURN(t);
+			}
+
+			if(e && e != s->F && (!s->vptr->is_string(e) || strlen(s->vptr->string_value(e)) != 1)) {
+				puts("String escape must be a single character or #f");
+				FREE_AND_RETURN(t);
+			}
+
+			t->object.string.delim  = strdup(s->vptr->string_value(d));
+			t->object.string.escape = !e ? '\\' : (e == s->F) ? -1 : (unsigned char)s->vptr->string_value(e)[0];
+			t->object.string.line   = s->vptr->is_symbol(l) && STR_CMP(s->vptr->symname(l), "single-line");
+			take_state(t, t->object.string.delim);
+			break;
+		}
+
+		case CONTEXT_TYPE_NUMBER:
+		case CONTEXT_TYPE_IDENTIFIER:
+			/* found by keyword table, while it splits text into words */
+			if(!keywords) keywords = new HiKeywords();
+			if(type == CONTEXT_TYPE_NUMBER)
+				t->object.keywords = keywords->number_group();
+			else
+				t->object.keywords = keywords->identifier_group();
+			break;
+
+		case CONTEXT_TYPE_KEYWORDS: {
+			if(!s->vptr->is_pair(content)) {
+				puts("Keywords must be a list of strings");
+				FREE_AND_RETURN(t);
+			}
+
+			/* compiled in load_context_table(), once keywords of all contexts are added */
+			if(!keywords) keywords = new HiKeywords();
+			t->object.keywords = keywords->group();
+
+			for(pointer it = content; s->vptr->is_pair(it); it = s->vptr->pair_cdr(it)) {
+				pointer w = s->vptr->pair_car(it);
+
+				if(!s->vptr->is_string(w) || !keywords->add(s->vptr->string_value(w), t->object.keywords))
+					puts("Keyword must be a string without spaces");
+			}
+			break;
+		}
+
+		case CONTEXT_TYPE_WORD_CHARS: {
+			if(!s->vptr->is_string(content)) {
+				puts("Word characters must be a string");
+				FREE_AND_RETURN(t);
+			}
+
+			if(!keywords) keywords = new HiKeywords();
+			keywords->add_word_chars(s->vptr->string_value(content));
+
+			/* nothing is painted with it */
+			FREE_AND_RETURN(t);
 		}
 
 		default: break;
@@ -794,24 +1613,356 @@ void Fl_Highlight_Editor_P::push_context(scheme *s, int type, pointer content, c
 		ctable->last->next = t;
 
 	ctable->last = t;
-}
 
-void Fl_Highlight_Editor_P::clear_contexts(void) {
-	if(!ctable) return;
+	if(face) {
+		t->face    = strdup(face);
+		t->face_id = faces.intern(t->face);
+	}
+}
 
+static void free_context_list(ContextTable *ctable) {
 	ContextTable *it, *nx;
+
 	for(it = ctable; it; it = nx) {
-		printf("removing: %s face\n", it->face);
 		nx = it->next;
 
-#if USE_POSIX_REGEX
-		if(it->type == CONTEXT_TYPE_REGEX)
-			regfree(it->object.rx);
+		switch(it->type) {
+#if USE_REGEX
+			case CONTEXT_TYPE_REGEX:
+				regex_free(it->object.rx);
+				break;
 #endif
+			case CONTEXT_TYPE_TO_EOL:
+			case CONTEXT_TYPE_EXACT:
+				free((char*)it->object.exact);
+				break;
+			case CONTEXT_TYPE_BLOCK:
+				free((char*)it->object.block[0]);
+				free((char*)it->object.block[1]);
+				break;
+			case CONTEXT_TYPE_STRING:
+				free((char*)it->object.string.delim);
+				break;
+			default: break;
+		}
+
+		free((char*)it->face);
 		delete it;
 	}
+}
+
+HiCompiledMode::HiCompiledMode(const char *m, unsigned int h) {
+	mode = m ? strdup(m) : NULL;
+	hash = h;
+	ctable   = NULL;
+	literals = NULL;
+	keywords = NULL;
+	context_states = 0;
+	context_engine = CONTEXT_ENGINE_OVERLAY;
+#if USE_DFA_REGEX
+	combined     = NULL;
+	combined_ctx = NULL;
+#endif
+	pattern_ctx = NULL;
+	next = NULL;
+}
+
+HiCompiledMode::~HiCompiledMode() {
+	free(mode);
+	free_context_list(ctable);
+	delete literals;
+	delete keywords;
+#if USE_DFA_REGEX
+	hi_regex_free(combined);
+	delete [] combined_ctx;
+#endif
+	delete [] pattern_ctx;
+}
+
+#if USE_REGEX
+void HiCompiledMode::index_regexes(void) {
+	int n = 0;
+
+	for(ContextTable *it = ctable; it; it = it->next) {
+		if(it->type == CONTEXT_TYPE_REGEX) n++;
+	}
+
+	pattern_ctx = new ContextTable*[n + 1];
+
+	for(ContextTable *it = ctable; it; it = it->next) {
+		if(it->type != CONTEXT_TYPE_REGEX) continue;
+
+		/* the same pattern used again is compiled again */
+		n = patterns.size();
+		if(patterns.intern(it->object.rx->pattern) == n)
+			pattern_ctx[n] = it;
+	}
+}
+
+/* take compiled pattern from context which used it; it is freed with the context otherwise */
+Regex *HiCompiledMode::take_regex(const char *pattern) {
+	int id = pattern_ctx ? patterns.find(pattern) : -1;
+	if(id < 0 || !pattern_ctx[id]) return NULL;
+
+	Regex *rx = pattern_ctx[id]->object.rx;
+	pattern_ctx[id]->object.rx = NULL;
+	pattern_ctx[id] = NULL;
+	return rx;
+}
+#endif
+
+void Fl_Highlight_Editor_P::clear_contexts(void) {
+	delete literals;
+	literals = NULL;
+	delete keywords;
+	keywords = NULL;
+
+#if USE_DFA_REGEX
+	hi_regex_free(combined);
+	delete [] combined_ctx;
+	combined = NULL;
+	combined_ctx = NULL;
+#endif
+	context_engine = CONTEXT_ENGINE_OVERLAY;
 
+	free(ctable_mode);
+	ctable_mode = NULL;
+	ctable_hash = 0;
+
+	if(!ctable) return;
+
+	free_context_list(ctable);
 	ctable = NULL;
+	context_states = 0;
+	faces.clear();
+}
+
+/* match rules disabled by hi_disable_rules() again; done when there is new text or new rules to try them on */
+void Fl_Highlight_Editor_P::enable_rules(void) {
+	for(ContextTable *it = ctable; it; it = it->next) {
+		it->disabled = false;
+		it->budget_spent = it->budget_bytes = 0;
+	}
+
+	free_rule_diags(diagnostics);
+	diagnostics = NULL;
+	line_cache.clear();
+}
+
+void Fl_Highlight_Editor_P::swap_contexts(HiCompiledMode *m) {
+	ContextTable *ct = ctable;
+	HiLiteral    *lt = literals;
+	HiKeywords   *kw = keywords;
+	int st = context_states, en = context_engine;
+
+	ctable   = m->ctable;   m->ctable   = ct;
+	literals = m->literals; m->literals = lt;
+	keywords = m->keywords; m->keywords = kw;
+	context_states = m->context_states; m->context_states = st;
+	context_engine = m->context_engine; m->context_engine = en;
+	faces.swap(m->faces);
+
+#if USE_DFA_REGEX
+	HiRegex       *cb  = combined;
+	ContextTable **cbc = combined_ctx;
+
+	combined     = m->combined;     m->combined     = cb;
+	combined_ctx = m->combined_ctx; m->combined_ctx = cbc;
+#endif
+}
+
+/* move compiled contexts to the front of 'modes', dropping the least recently used mode if there are too many */
+void Fl_Highlight_Editor_P::stash_contexts(void) {
+	if(!ctable) {
+		clear_contexts();
+		return;
+	}
+
+	HiCompiledMode *m = new HiCompiledMode(ctable_mode, ctable_hash);
+	swap_contexts(m);
+	clear_contexts();
+	cache_mode(m);
+}
+
+void Fl_Highlight_Editor_P::cache_mode(HiCompiledMode *m) {
+	HiCompiledMode *it;
+
+	m->next = modes;
+	modes   = m;
+
+	int n = 1;
+	for(it = modes; it->next && n < MODE_CACHE_SIZE; it = it->next)
+		n++;
+
+	if(it->next) {
+		delete it->next;
+		it->next = NULL;
+	}
+}
+
+/* remove and return mode with given name (and hash, if 'match_hash' is set) or NULL */
+HiCompiledMode *Fl_Highlight_Editor_P::unlink_mode(const char *mode, unsigned int hash, bool match_hash) {
+	for(HiCompiledMode **it = &modes; *it; it = &(*it)->next) {
+		HiCompiledMode *m = *it;
+
+		if((!m->mode || !mode) ? m->mode != mode : !STR_CMP(m->mode, mode)) continue;
+		if(match_hash && m->hash != hash) continue;
+
+		*it = m->next;
+		m->next = NULL;
+		return m;
+	}
+
+	return NULL;
+}
+
+void Fl_Highlight_Editor_P::clear_modes(void) {
+	HiCompiledMode *nx;
+
+	for(; modes; modes = nx) {
+		nx = modes->next;
+		delete modes;
+	}
+}
+
+void Fl_Highlight_Editor_P::resize_line_states(int nlines) {
+	/* grow if needed; states are always zeroed, so line without state is outside any block */
+	if(nlines > line_state_size) {
+		unsigned int *old = line_state;
+
+		line_state_size = line_state_size ? line_state_size : 64;
+		while(line_state_size < nlines)
+			line_state_size *= 2;
+
+		line_state = new unsigned int[line_state_size];
+		if(old) {
+			memcpy(line_state, old, sizeof(unsigned int) * line_state_last);
+			delete [] old;
+		}
+	}
+
+	if(nlines > line_state_last)
+		memset(line_state + line_state_last, 0, sizeof(unsigned int) * (nlines - line_state_last));
+
+	line_state_last = nlines;
+}
+
+/*
+ * Edit replaced 'ndeleted' newlines after 'line' with 'ninserted' ones. States of lines after the edit are moved
+ * to their new line numbers and the line where edit ended keeps its old state, so hi_update() can compare against it.
+ */
+void Fl_Highlight_Editor_P::shift_line_states(int line, int ndeleted, int ninserted) {
+	ASSERT(line + ndeleted < line_state_last);
+
+	int tail = line_state_last - line - ndeleted;
+	int nlines = line_state_last - ndeleted + ninserted;
+
+	if(ninserted > ndeleted)
+		resize_line_states(nlines);
+
+	memmove(line_state + line + ninserted, line_state + line + ndeleted, sizeof(unsigned int) * tail);
+	memset(line_state + line, 0, sizeof(unsigned int) * ninserted);
+	line_state_last = nlines;
+}
+
+void Fl_Highlight_Editor_P::clear_line_states(void) {
+	delete [] line_state;
+	line_state = NULL;
+	line_state_size = line_state_last = 0;
+	line_hint_pos = line_hint_line = 0;
+	lexed_line = lexed_pos = 0;
+}
+
+/* start of the first visible line and number of lines display can show */
+void Fl_Highlight_Editor_P::visible_lines(int *start, int *nlines) {
+	*start  = self->buffer()->line_start(self->mFirstChar);
+	*nlines = self->mNVisibleLines;
+}
+
+/* text of visible lines, including the newline of the last one */
+void Fl_Highlight_Editor_P::visible_range(int *start, int *end) {
+	Fl_Text_Buffer *buf = self->buffer();
+
+	*start = buf->line_start(self->mFirstChar);
+	*end   = buf->line_end(self->mLastChar);
+	if(*end < buf->length()) (*end)++;
+}
+
+/* the first and the last visible character; with wrapping, lines can be visible only in part */
+void Fl_Highlight_Editor_P::visible_chars(int *start, int *end) {
+	*start = self->mFirstChar;
+	*end   = self->mLastChar;
+}
+
+/*
+ * Set highlighted styles. Only spans where styles changed are stored and redrawn, and only if they are visible;
+ * the rest is given to display when it is scrolled to.
+ */
+void Fl_Highlight_Editor_P::store_styles(int pos, int len, const char *style) {
+	changed.clear();
+	if(!styles.diff(pos, len, style, &changed)) return;
+
+	int first = changed.start[0], last = changed.end[changed.n - 1], vstart, vend, s, e, counted = 0;
+	Fl_Text_Buffer *buf = self->buffer();
+
+	styles.replace(first, last - first, style + (first - pos), last - first);
+	visible_range(&vstart, &vend);
+
+	for(int i = 0; i < changed.n; i++) {
+		stale.add(changed.start[i], changed.end[i]);
+
+		s = (changed.start[i] > vstart) ? changed.start[i] : vstart;
+		e = (changed.end[i] < vend) ? changed.end[i] : vend;
+		if(s >= e) continue;
+
+		self->redisplay_range(s, e);
+
+		/* count every line once, even if it has more changed spans */
+		s = buf->line_start(s);
+		if(s < counted) s = counted;
+		if(s < e) {
+			redrawn_lines += buf->count_lines(s, e - 1) + 1;
+			counted = buf->line_end(e - 1) + 1;
+		}
+	}
+}
+
+/* copy stale styles of visible lines to 'stylebuf' */
+void Fl_Highlight_Editor_P::sync_visible_styles() {
+	if(!stylebuf || stale.empty()) return;
+
+	int start, end, s, e;
+	visible_range(&start, &end);
+	if(end > stylebuf->length()) end = stylebuf->length();
+
+	for(int i = 0; i < stale.n && stale.start[i] < end; i++) {
+		s = (stale.start[i] > start) ? stale.start[i] : start;
+		e = (stale.end[i] < end) ? stale.end[i] : end;
+		if(s < e) stylebuf->copy_from(&styles, s, e);
+	}
+
+	stale.remove(start, end);
+}
+
+/* free reused buffers that grew too large */
+void Fl_Highlight_Editor_P::trim_scratch() {
+	if(style_tmp_size > SCRATCH_KEEP_SIZE) {
+		delete [] style_tmp;
+		style_tmp = NULL;
+		style_tmp_size = 0;
+	}
+
+	if(eol_tmp_size > SCRATCH_KEEP_SIZE / (int)sizeof(unsigned int)) {
+		delete [] eol_tmp;
+		eol_tmp = NULL;
+		eol_tmp_size = 0;
+	}
+
+	if(gap_line_size > SCRATCH_KEEP_SIZE) {
+		delete [] gap_line;
+		gap_line = NULL;
+		gap_line_size = 0;
+	}
 }
 
 Fl_Highlight_Editor::Fl_Highlight_Editor(int X, int Y, int W, int H, const char *l) :
@@ -825,6 +1976,11 @@ Fl_Highlight_Editor::~Fl_Highlight_Editor() {
 	puts("~Fl_Highlight_Editor");
 	if(!priv) return;
 
+	Fl::remove_idle(hi_idle, priv);
+#if USE_HIGHLIGHT_THREAD
+	hi_worker_stop(priv);
+#endif
+
 	if(priv->script_path)
 		free(priv->script_path);
 
@@ -832,8 +1988,15 @@ Fl_Highlight_Editor::~Fl_Highlight_Editor() {
 		scheme_deinit(priv->scm);
 
 	priv->clear_contexts();
+	priv->clear_modes();
+	priv->clear_mode_image();
+	free_rule_diags(priv->diagnostics);
 	priv->clear_styles();
+	priv->clear_line_states();
 
+	delete [] priv->style_tmp;
+	delete [] priv->eol_tmp;
+	delete [] priv->gap_line;
 	delete priv->stylebuf;
 	delete priv;
 	priv = NULL;
@@ -859,6 +2022,15 @@ void Fl_Highlight_Editor::init_interpreter(const char *script_folder, bool do_re
 
 	SCHEME_DEFINE_VAR(scm, "*editor-current-mode*", scm->F);
 	SCHEME_DEFINE_VAR(scm, "*editor-context-table*", scm->NIL);
+	SCHEME_DEFINE_VAR(scm, "*editor-context-engine*", scm->vptr->mk_symbol(scm, "overlay"));
+	SCHEME_DEFINE_VAR(scm, "*editor-mode-images*", scm->F);
+	SCHEME_DEFINE_VAR(scm, "*editor-idle-highlight-budget*", scm->vptr->mk_integer(scm, 10));
+	SCHEME_DEFINE_VAR(scm, "*editor-highlight-thread*", scm->F);
+	SCHEME_DEFINE_VAR(scm, "*editor-parallel-highlight*", scm->vptr->mk_integer(scm, 0));
+	SCHEME_DEFINE_VAR(scm, "*editor-rule-budget*", scm->vptr->mk_integer(scm, 100));
+	SCHEME_DEFINE_VAR(scm, "*editor-line-cache-size*", scm->vptr->mk_integer(scm, 0));
+	SCHEME_DEFINE_VAR(scm, "*editor-max-line-length*", scm->vptr->mk_integer(scm, 32 * 1024));
+	SCHEME_DEFINE_VAR(scm, "*editor-large-file-thresholds*", scm->NIL);
 	SCHEME_DEFINE_VAR(scm, "*editor-face-table*", scm->NIL);
 	SCHEME_DEFINE_VAR(scm, "*editor-auto-mode-alist*", scm->NIL);
 	SCHEME_DEFINE_VAR(scm, "*editor-before-loadfile-hook*", scm->NIL);
@@ -881,248 +2053,2516 @@ void Fl_Highlight_Editor::init_interpreter(const char *script_folder, bool do_re
 		fclose(fd);
 	}
 
-	/* editor specific code */
-	snprintf(buf, sizeof(buf), "%s/editor.ss", script_folder);
-	fd = fopen(buf, "r");
-	if(fd) {
-		scm->vptr->load_file(scm, fd);
-		fclose(fd);
-	}
+	/* editor specific code */
+	snprintf(buf, sizeof(buf), "%s/editor.ss", script_folder);
+	fd = fopen(buf, "r");
+	if(fd) {
+		scm->vptr->load_file(scm, fd);
+		fclose(fd);
+	}
+#endif
+
+	float diff = (((float)clock() - (float)started) / CLOCKS_PER_SEC) * 1000;
+	printf("Interpreter booted in %4.1fms.\n", diff);
+
+	if(do_repl)
+		scheme_load_named_file(scm, stdin, 0);
+
+	priv->scm = scm;
+}
+
+void Fl_Highlight_Editor::load_script_file(const char *path) {
+	if(!priv) return;
+	FILE *fd = fopen(path, "r");
+	if(!fd) return;
+
+	scheme_load_named_file(priv->scm, fd, path);
+	fclose(fd);
+}
+
+void Fl_Highlight_Editor::load_script_string(const char *str) {
+	if(!priv) return;
+	scheme_load_string(priv->scm, str);
+}
+
+const char *Fl_Highlight_Editor::script_folder(void) {
+	if(!priv) return NULL;
+	return priv->script_path;
+}
+
+#if USE_DFA_REGEX
+/*
+ * Compile all contexts into single automaton for CONTEXT_ENGINE_COMBINED. Literal tokens are quoted, to eol token
+ * becomes token followed by the rest of the line and blocks and strings are represented with starting token; their end
+ * is searched for in hi_parse_combined(). Fails if some regex was compiled with POSIX regex.
+ */
+static bool combined_context(ContextTable *ct) {
+	switch(ct->type) {
+		case CONTEXT_TYPE_REGEX:
+			return true;
+		case CONTEXT_TYPE_EXACT:
+		case CONTEXT_TYPE_TO_EOL:
+		case CONTEXT_TYPE_STRING:
+			return ct->literal[0] != -1;
+		case CONTEXT_TYPE_BLOCK:
+			return ct->literal[0] != -1 && ct->literal[1] != -1;
+	}
+
+	return false;
+}
+
+static bool compile_combined(Fl_Highlight_Editor_P *priv) {
+	ContextTable *it;
+	int n = 0, i;
+
+	for(it = priv->ctable; it; it = it->next) {
+		if(it->type == CONTEXT_TYPE_REGEX && !it->object.rx->dfa)
+			return false;
+
+		if(combined_context(it))
+			n++;
+	}
+
+	if(!n) return false;
+
+	char **patterns = new char*[n];
+	priv->combined_ctx = new ContextTable*[n];
+
+	for(it = priv->ctable, i = 0; it; it = it->next) {
+		if(!combined_context(it)) continue;
+
+		if(it->type == CONTEXT_TYPE_REGEX) {
+			patterns[i] = strdup(it->object.rx->pattern);
+		} else if(it->type == CONTEXT_TYPE_BLOCK) {
+			patterns[i] = hi_regex_quote(it->object.block[0]);
+		} else if(it->type == CONTEXT_TYPE_STRING) {
+			patterns[i] = hi_regex_quote(it->object.string.delim);
+		} else {
+			patterns[i] = hi_regex_quote(it->object.exact);
+
+			if(it->type == CONTEXT_TYPE_TO_EOL) {
+				patterns[i] = (char*)realloc(patterns[i], strlen(patterns[i]) + 3);
+				strcat(patterns[i], ".*");
+			}
+		}
+
+		priv->combined_ctx[i++] = it;
+	}
+
+	priv->combined = hi_regex_compile_set((const char**)patterns, n, HI_REGEX_NEWLINE);
+
+	for(i = 0; i < n; i++)
+		free(patterns[i]);
+	delete [] patterns;
+
+	if(!priv->combined) {
+		delete [] priv->combined_ctx;
+		priv->combined_ctx = NULL;
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+/* hash of the strings in 'v' (string, symbol or pair of them) */
+static unsigned int hash_value(scheme *s, pointer v, unsigned int h) {
+	if(s->vptr->is_string(v))
+		return hi_hash_string(h, s->vptr->string_value(v));
+	if(s->vptr->is_symbol(v))
+		return hi_hash_string(h ^ 's', s->vptr->symname(v));
+	if(s->vptr->is_integer(v))
+		return (h ^ (unsigned int)s->vptr->ivalue(v)) * 16777619U;
+	if(s->vptr->is_pair(v))
+		return hash_value(s, s->vptr->pair_cdr(v), hash_value(s, s->vptr->pair_car(v), h ^ 'p'));
+
+	return (h ^ 'x') * 16777619U;
+}
+
+/* hash of everything load_context_table() compiles contexts from */
+static unsigned int context_table_hash(scheme *s, pointer table, pointer engine) {
+	unsigned int h = hash_value(s, engine, HI_HASH_INIT);
+
+	for(pointer it = table; s->vptr->is_pair(it); it = s->vptr->pair_cdr(it)) {
+		pointer v = s->vptr->pair_car(it);
+		if(!s->vptr->is_vector(v)) continue;
+
+		for(int i = 0; i < (int)s->vptr->vector_length(v); i++)
+			h = hash_value(s, s->vptr->vector_elem(v, i), h);
+		h = (h ^ 'v') * 16777619U;
+	}
+
+	return h;
+}
+
+static Fl_Highlight_Editor_P *load_context_table(Fl_Highlight_Editor_P *priv) {
+	scheme *s = priv->scm;
+	pointer tp, f, v, style_table = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-context-table*"));
+	pointer engine = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-context-engine*"));
+	char *face;
+
+	v = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-current-mode*"));
+	const char   *mode = s->vptr->is_string(v) ? s->vptr->string_value(v) : NULL;
+	unsigned int  hash = context_table_hash(s, style_table, engine);
+
+	priv->ctable_mode = mode ? strdup(mode) : NULL;
+	priv->ctable_hash = hash;
+
+	/* the same rules were compiled before */
+	HiCompiledMode *m = priv->unlink_mode(mode, hash, true);
+	if(m) {
+		priv->swap_contexts(m);
+		delete m;
+
+		/* faces are assigned again by load_face_table(); until then, don't use what current table doesn't have */
+		for(ContextTable *ct = priv->ctable; ct; ct = ct->next) {
+			if(ct->pos >= priv->styletable_last) {
+				ct->pos = 0;
+				ct->chr = 'A';
+			}
+		}
+
+		return priv;
+	}
+
+	/* older version of the mode; regex rules that didn't change are taken from it */
+	priv->reuse = priv->unlink_mode(mode, 0, false);
+#if USE_REGEX
+	if(priv->reuse) priv->reuse->index_regexes();
+#endif
+
+	for(pointer it = style_table; it != s->NIL; it = s->vptr->pair_cdr(it)) {
+		v = s->vptr->pair_car(it);
+
+		if(!s->vptr->is_vector(v))
+			continue;
+
+		if(s->vptr->vector_length(v) != 3) {
+			printf("Expected vector len of 3 but got len '%i'\n", (int)s->vptr->vector_length(v));
+			continue;
+		}
+
+		/* fetch type */
+		tp = s->vptr->vector_elem(v, 0);
+		if(!s->vptr->is_integer(tp))
+			continue;
+
+		/* fetch face; we limit ourself face must be either symbol or string, or #f for entries that paint nothing */
+		f = s->vptr->vector_elem(v, 2);
+		if(f == s->F)
+			face = NULL;
+		else if(s->vptr->is_symbol(f) || s->vptr->is_string(f))
+			face = s->vptr->is_symbol(f) ? s->vptr->symname(f) : s->vptr->string_value(f);
+		else
+			continue;
+
+		priv->push_context(s, s->vptr->ivalue(tp), s->vptr->vector_elem(v, 1), face);
+	}
+
+	delete priv->reuse;
+	priv->reuse = NULL;
+
+	/* compile literal tokens of all contexts into single matcher */
+	priv->literals = new HiLiteral();
+
+	for(ContextTable *ct = priv->ctable; ct; ct = ct->next) {
+		if(ct->type == CONTEXT_TYPE_EXACT || ct->type == CONTEXT_TYPE_TO_EOL) {
+			ct->literal[0] = priv->literals->add(ct->object.exact);
+		} else if(ct->type == CONTEXT_TYPE_BLOCK) {
+			ct->literal[0] = priv->literals->add(ct->object.block[0]);
+			ct->literal[1] = priv->literals->add(ct->object.block[1]);
+		} else if(ct->type == CONTEXT_TYPE_STRING) {
+			ct->literal[0] = priv->literals->add(ct->object.string.delim);
+		}
+	}
+
+	priv->literals->compile();
+
+	if(priv->keywords && !priv->keywords->compile()) {
+		puts("Unable to compile keywords; keyword contexts will not be painted");
+		delete priv->keywords;
+		priv->keywords = NULL;
+	}
+
+	/* engine */
+	if(s->vptr->is_symbol(engine) && STR_CMP(s->vptr->symname(engine), "combined")) {
+#if USE_DFA_REGEX
+		if(compile_combined(priv))
+			priv->context_engine = CONTEXT_ENGINE_COMBINED;
+		else
+			puts("Unable to compile contexts into combined engine; using overlay engine");
+#else
+		puts("Combined engine requires builtin regex (USE_DFA_REGEX); using overlay engine");
+#endif
+	}
+
+	return priv;
+}
+
+/*
+ * Mode images. When mode is loaded from its file, its rules are compiled as usual and then written into image next to
+ * the file (<mode>.ssi) together with the rules themselves as Scheme data. On the next start, editor-try-load-mode
+ * calls editor-load-mode-image first: if every mode file the image was made from is unchanged, context table and
+ * engine are restored from the image and compiled contexts are put into mode cache, where load_context_table() finds
+ * them by the hash of restored table. Mode file is then not evaluated and no pattern is compiled again. Images are
+ * written into the mode directory, so this is done only if *editor-mode-images* was set.
+ */
+
+/* Scheme values mode rules are made of; table with anything else is not written into image */
+enum {
+	IMAGE_NIL,
+	IMAGE_FALSE,
+	IMAGE_TRUE,
+	IMAGE_INTEGER,
+	IMAGE_STRING,
+	IMAGE_SYMBOL,
+	IMAGE_PAIR,
+	IMAGE_VECTOR
+};
+
+/* nesting of values in image; mode tables are list of vectors, so this is never reached by valid image */
+#define IMAGE_MAX_DEPTH 4096
+
+static char *mode_image_path(const char *path) {
+	int   n   = strlen(path) + 2;
+	char *ret = (char*)malloc(n);
+
+	snprintf(ret, n, "%si", path);
+	return ret;
+}
+
+static bool save_value(scheme *s, pointer v, HiImageWriter *w, int depth) {
+	if(depth > IMAGE_MAX_DEPTH)
+		return false;
+
+	if(v == s->NIL) {
+		w->put_int(IMAGE_NIL);
+	} else if(v == s->F) {
+		w->put_int(IMAGE_FALSE);
+	} else if(v == s->T) {
+		w->put_int(IMAGE_TRUE);
+	} else if(s->vptr->is_integer(v)) {
+		w->put_int(IMAGE_INTEGER);
+		w->put_long(s->vptr->ivalue(v));
+	} else if(s->vptr->is_string(v)) {
+		w->put_int(IMAGE_STRING);
+		w->put_str(s->vptr->string_value(v));
+	} else if(s->vptr->is_symbol(v)) {
+		w->put_int(IMAGE_SYMBOL);
+		w->put_str(s->vptr->symname(v));
+	} else if(s->vptr->is_pair(v)) {
+		w->put_int(IMAGE_PAIR);
+		return save_value(s, s->vptr->pair_car(v), w, depth + 1) && save_value(s, s->vptr->pair_cdr(v), w, depth + 1);
+	} else if(s->vptr->is_vector(v)) {
+		int n = s->vptr->vector_length(v);
+		w->put_int(IMAGE_VECTOR);
+		w->put_int(n);
+
+		for(int i = 0; i < n; i++) {
+			if(!save_value(s, s->vptr->vector_elem(v, i), w, depth + 1))
+				return false;
+		}
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/* values are created while Scheme function runs, so interpreter keeps them until it returns */
+static pointer load_value(scheme *s, HiImageReader *r, int depth) {
+	int tag = r->get_int();
+	const char *str;
+
+	if(r->error || depth > IMAGE_MAX_DEPTH) {
+		r->error = true;
+		return s->NIL;
+	}
+
+	switch(tag) {
+		case IMAGE_NIL:
+			return s->NIL;
+		case IMAGE_FALSE:
+			return s->F;
+		case IMAGE_TRUE:
+			return s->T;
+		case IMAGE_INTEGER:
+			return s->vptr->mk_integer(s, (long)r->get_long());
+		case IMAGE_STRING:
+		case IMAGE_SYMBOL:
+			if(!(str = r->get_str())) break;
+			return (tag == IMAGE_STRING) ? s->vptr->mk_string(s, str) : s->vptr->mk_symbol(s, str);
+		case IMAGE_PAIR: {
+			pointer a = load_value(s, r, depth + 1);
+			pointer b = load_value(s, r, depth + 1);
+			return s->vptr->cons(s, a, b);
+		}
+		case IMAGE_VECTOR: {
+			int n = r->get_int();
+			if(r->error || n < 0 || n > r->end - r->p) break;
+
+			pointer v = s->vptr->mk_vector(s, n);
+			for(int i = 0; i < n; i++)
+				s->vptr->set_vector_elem(v, i, load_value(s, r, depth + 1));
+			return v;
+		}
+	}
+
+	r->error = true;
+	return s->NIL;
+}
+
+static bool write_mode_image(Fl_Highlight_Editor_P *priv, HiImageWriter *w) {
+	scheme *s = priv->scm;
+	ContextTable *ct;
+	struct stat st;
+	int n;
+
+	w->header();
+
+	/* image is used only while these are the same */
+	w->put_int(priv->image_nsources);
+	for(int i = 0; i < priv->image_nsources; i++) {
+		if(stat(priv->image_sources[i], &st) != 0)
+			return false;
+
+		w->put_str(priv->image_sources[i]);
+		w->put_long((long long)st.st_mtime);
+		w->put_long((long long)st.st_size);
+	}
+
+	/* rules as contexts were compiled from them */
+	pointer table  = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-context-table*"));
+	pointer engine = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-context-engine*"));
+
+	if(context_table_hash(s, table, engine) != priv->ctable_hash)
+		return false;
+
+	w->put_str(priv->ctable_mode);
+	w->put_int((int)priv->ctable_hash);
+
+	if(!save_value(s, table, w, 0) || !save_value(s, engine, w, 0))
+		return false;
+
+	w->put_int(priv->context_states);
+	w->put_int(priv->context_engine);
+
+	for(ct = priv->ctable, n = 0; ct; ct = ct->next)
+		n++;
+	w->put_int(n);
+
+	for(ct = priv->ctable; ct; ct = ct->next) {
+		w->put_int(ct->type);
+		w->put_int((int)ct->state);
+		w->put_str(ct->face);
+		w->put_int(ct->literal[0]);
+		w->put_int(ct->literal[1]);
+
+		switch(ct->type) {
+			case CONTEXT_TYPE_REGEX:
+#if USE_DFA_REGEX
+				/* patterns only POSIX regex understands can't be saved */
+				if(!ct->object.rx->dfa) return false;
+
+				w->put_str(ct->object.rx->pattern);
+				hi_regex_save(ct->object.rx->dfa, w);
+				break;
+#else
+				return false;
+#endif
+			case CONTEXT_TYPE_TO_EOL:
+			case CONTEXT_TYPE_EXACT:
+				w->put_str(ct->object.exact);
+				break;
+			case CONTEXT_TYPE_BLOCK:
+				w->put_str(ct->object.block[0]);
+				w->put_str(ct->object.block[1]);
+				break;
+			case CONTEXT_TYPE_STRING:
+				w->put_str(ct->object.string.delim);
+				w->put_int(ct->object.string.escape);
+				w->put_int(ct->object.string.line);
+				break;
+			case CONTEXT_TYPE_KEYWORDS:
+			case CONTEXT_TYPE_NUMBER:
+			case CONTEXT_TYPE_IDENTIFIER:
+				w->put_int(ct->object.keywords);
+				break;
+			default: break;
+		}
+	}
+
+	priv->literals->save(w);
+
+	w->put_int(priv->keywords != NULL);
+	if(priv->keywords) priv->keywords->save(w);
+
+#if USE_DFA_REGEX
+	if(priv->context_engine == CONTEXT_ENGINE_COMBINED) {
+		for(ct = priv->ctable, n = 0; ct; ct = ct->next) {
+			if(combined_context(ct)) n++;
+		}
+		w->put_int(n);
+
+		/* contexts of combined patterns by their position in ctable */
+		for(int i = 0; i < n; i++) {
+			int idx = 0;
+			for(ct = priv->ctable; ct != priv->combined_ctx[i]; ct = ct->next)
+				idx++;
+			w->put_int(idx);
+		}
+
+		hi_regex_save(priv->combined, w);
+	}
+#endif
+
+	return true;
+}
+
+/* compiled contexts written by write_mode_image(); returns NULL if image is damaged */
+static HiCompiledMode *read_compiled_mode(HiImageReader *r, const char *mode, unsigned int hash) {
+	HiCompiledMode *m = new HiCompiledMode(mode, hash);
+	ContextTable  **all = NULL, *t;
+	int i, n;
+
+	m->context_states = r->get_int();
+	m->context_engine = r->get_int();
+	n = r->get_int();
+
+	bool ok = !r->error && n >= 0 && n <= r->end - r->p &&
+			  m->context_states >= 0 && m->context_states <= (int)(sizeof(t->state) * CHAR_BIT) &&
+			  (m->context_engine == CONTEXT_ENGINE_OVERLAY || m->context_engine == CONTEXT_ENGINE_COMBINED);
+
+	if(ok) all = new ContextTable*[n + 1];
+
+	for(i = 0; ok && i < n; i++) {
+		t = new ContextTable();
+		t->chr = 'A';
+		t->pos = 0;
+		t->face = NULL;
+		t->face_id = -1;
+		t->object.block[0] = t->object.block[1] = NULL;
+		t->disabled = false;
+		t->prof_bytes = t->prof_skipped = 0;
+		t->budget_spent = t->budget_bytes = 0;
+		t->last = t->next = NULL;
+
+		/* linked first, so it is freed with the mode if something below fails */
+		if(!m->ctable)
+			m->ctable = t;
+		else
+			m->ctable->last->next = t;
+		m->ctable->last = t;
+		all[i] = t;
+
+		t->type  = r->get_int();
+		t->state = (unsigned int)r->get_int();
+
+		const char *face = r->get_str();
+		if(face) {
+			t->face    = strdup(face);
+			t->face_id = m->faces.intern(t->face);
+		}
+
+		t->literal[0] = r->get_int();
+		t->literal[1] = r->get_int();
+
+		/* every block has own bit, below the number of bits mode uses */
+		ok = !r->error && t->type >= CONTEXT_TYPE_INITIAL && t->type < CONTEXT_TYPE_LAST &&
+			 (t->state & (t->state - 1)) == 0 &&
+			 (m->context_states == (int)(sizeof(t->state) * CHAR_BIT) || t->state < (1U << m->context_states));
+
+		switch(ok ? t->type : -1) {
+			case CONTEXT_TYPE_REGEX: {
+#if USE_DFA_REGEX
+				const char *p   = r->get_str();
+				HiRegex    *dfa = p ? hi_regex_load(r, 1) : NULL;
+
+				if(!dfa) {
+					ok = false;
+					break;
+				}
+
+				t->object.rx = (Regex*)calloc(1, sizeof(Regex));
+				t->object.rx->pattern = strdup(p);
+				t->object.rx->dfa = dfa;
+				regex_find_literals(t->object.rx, RX_EXTENDED | RX_NEWLINE);
+#else
+				ok = false;
+#endif
+				break;
+			}
+
+			case CONTEXT_TYPE_TO_EOL:
+			case CONTEXT_TYPE_EXACT: {
+				const char *e = r->get_str();
+				if(e) t->object.exact = strdup(e);
+				ok = (e != NULL);
+				break;
+			}
+
+			case CONTEXT_TYPE_BLOCK: {
+				const char *b0 = r->get_str(), *b1 = r->get_str();
+				if(b0 && b1) {
+					t->object.block[0] = strdup(b0);
+					t->object.block[1] = strdup(b1);
+				}
+				ok = (b0 && b1);
+				break;
+			}
+
+			case CONTEXT_TYPE_STRING: {
+				const char *d = r->get_str();
+				if(d) t->object.string.delim = strdup(d);
+
+				t->object.string.escape = r->get_int();
+				t->object.string.line   = (r->get_int() != 0);
+				ok = d && d[0] && !r->error && t->object.string.escape >= -1 && t->object.string.escape < 256;
+				break;
+			}
+
+			case CONTEXT_TYPE_KEYWORDS:
+			case CONTEXT_TYPE_NUMBER:
+			case CONTEXT_TYPE_IDENTIFIER:
+				t->object.keywords = r->get_int();
+				ok = !r->error;
+				break;
+
+			default: break;
+		}
+	}
+
+	if(ok) {
+		m->literals = new HiLiteral();
+		ok = m->literals->load(r);
+	}
+
+	if(ok && r->get_int()) {
+		m->keywords = new HiKeywords();
+		ok = m->keywords->load(r);
+	}
+
+	for(t = m->ctable; ok && t; t = t->next) {
+		ok = t->literal[0] >= -1 && t->literal[0] < m->literals->npatterns &&
+			 t->literal[1] >= -1 && t->literal[1] < m->literals->npatterns;
+
+		if(ok && t->type == CONTEXT_TYPE_STRING)
+			ok = t->literal[0] >= 0;
+
+		if(ok && (t->type == CONTEXT_TYPE_KEYWORDS || t->type == CONTEXT_TYPE_NUMBER || t->type == CONTEXT_TYPE_IDENTIFIER))
+			ok = m->keywords && t->object.keywords >= 0 && t->object.keywords < m->keywords->ngroups;
+	}
+
+#if USE_DFA_REGEX
+	if(ok && m->context_engine == CONTEXT_ENGINE_COMBINED) {
+		int nc = r->get_int();
+		ok = !r->error && nc > 0 && nc <= n;
+
+		if(ok) {
+			m->combined_ctx = new ContextTable*[nc];
+
+			for(i = 0; ok && i < nc; i++) {
+				int idx = r->get_int();
+				ok = !r->error && idx >= 0 && idx < n;
+				m->combined_ctx[i] = ok ? all[idx] : NULL;
+			}
+		}
+
+		if(ok) {
+			m->combined = hi_regex_load(r, nc);
+			ok = (m->combined != NULL);
+		}
+	}
+#else
+	if(m->context_engine == CONTEXT_ENGINE_COMBINED) ok = false;
+#endif
+
+	delete [] all;
+
+	if(!ok || r->error) {
+		delete m;
+		return NULL;
+	}
+
+	return m;
+}
+
+pointer Fl_Highlight_Editor_P::load_mode_image(scheme *s, const char *mode, const char *path) {
+	HiImageReader r;
+	struct stat   st;
+	char *ipath = mode_image_path(path);
+	bool  ok    = r.open(ipath) && r.header();
+
+	free(ipath);
+	if(!ok) return s->F;
+
+	/* every mode file must be the same as when image was written, starting with the mode's own */
+	pointer sources = s->NIL;
+	int n = r.get_int();
+
+	if(r.error || n < 1) return s->F;
+
+	for(int i = 0; i < n; i++) {
+		const char *src  = r.get_str();
+		long long mtime  = r.get_long();
+		long long size   = r.get_long();
+
+		if(!src || (i == 0 && !STR_CMP(src, path)) || stat(src, &st) != 0 ||
+		   (long long)st.st_mtime != mtime || (long long)st.st_size != size)
+		{
+			return s->F;
+		}
+
+		sources = s->vptr->cons(s, s->vptr->mk_string(s, src), sources);
+	}
+
+	const char  *name = r.get_str();
+	unsigned int hash = (unsigned int)r.get_int();
+
+	if(!name || !STR_CMP(name, mode)) return s->F;
+
+	pointer table  = load_value(s, &r, 0);
+	pointer engine = load_value(s, &r, 0);
+
+	if(r.error || context_table_hash(s, table, engine) != hash) return s->F;
+
+	/* these rules can be already compiled, if mode was used before */
+	HiCompiledMode *m = unlink_mode(mode, hash, true);
+	if(!m) {
+		m = read_compiled_mode(&r, mode, hash);
+		if(!m) return s->F;
+
+		delete unlink_mode(mode, 0, false);
+	}
+
+	cache_mode(m);
+
+	pointer ret = s->vptr->cons(s, scheme_reverse_in_place(s, s->NIL, sources), s->NIL);
+	ret = s->vptr->cons(s, engine, ret);
+	return s->vptr->cons(s, table, ret);
+}
+
+void Fl_Highlight_Editor_P::prepare_mode_image(scheme *s, const char *mode, const char *path, pointer sources) {
+	clear_mode_image();
+
+	int n = 0;
+	for(pointer it = sources; s->vptr->is_pair(it); it = s->vptr->pair_cdr(it))
+		n++;
+
+	image_mode    = strdup(mode);
+	image_path    = mode_image_path(path);
+	image_sources = new char*[n + 1];
+
+	for(pointer it = sources; s->vptr->is_pair(it); it = s->vptr->pair_cdr(it)) {
+		pointer v = s->vptr->pair_car(it);
+		if(s->vptr->is_string(v))
+			image_sources[image_nsources++] = strdup(s->vptr->string_value(v));
+	}
+}
+
+void Fl_Highlight_Editor_P::save_mode_image(void) {
+	if(!image_mode) return;
+
+	/* only if contexts were compiled from the mode that was just loaded */
+	if(scm && ctable && ctable_mode && STR_CMP(ctable_mode, image_mode) && image_nsources > 0) {
+		HiImageWriter w;
+
+		/* failing to write it (e.g. read-only mode directory) only means the mode is compiled again next time */
+		if(write_mode_image(this, &w))
+			w.save(image_path);
+	}
+
+	clear_mode_image();
+}
+
+void Fl_Highlight_Editor_P::clear_mode_image(void) {
+	for(int i = 0; i < image_nsources; i++)
+		free(image_sources[i]);
+
+	delete [] image_sources;
+	free(image_mode);
+	free(image_path);
+
+	image_mode = image_path = NULL;
+	image_sources  = NULL;
+	image_nsources = 0;
+}
+
+#define VECTOR_GET_INT(scm, vec, pos, tmp, ret)	\
+do {											\
+	tmp = scm->vptr->vector_elem(vec, pos);		\
+	if(!s->vptr->is_integer(tmp)) continue;		\
+	ret = s->vptr->ivalue(tmp);					\
+} while(0)
+
+static Fl_Highlight_Editor_P *load_face_table(Fl_Highlight_Editor_P *priv) {
+	scheme *s = priv->scm;
+	const char *face;
+	pointer o, v, face_table = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-face-table*"));
+	int font = 0, color = 0, size = 0, id;
+
+	/* position inside StyleTable of every face used by contexts; -1 if face table doesn't have it */
+	int *face_pos = new int[priv->faces.size() + 1];
+	for(int i = 0; i < priv->faces.size(); i++)
+		face_pos[i] = -1;
+
+	for(pointer it = face_table; it != s->NIL; it = s->vptr->pair_cdr(it)) {
+		v = s->vptr->pair_car(it);
+
+		if(!s->vptr->is_vector(v) || s->vptr->vector_length(v) != 4)
+			continue;
+
+		o = s->vptr->vector_elem(v, 0);
+		if(!s->vptr->is_symbol(o) && !s->vptr->is_string(o))
+			continue;
+
+		face = s->vptr->is_string(o) ? s->vptr->string_value(o) : s->vptr->symname(o);
+
+		/* we support both FLTK and html colors */
+		o = s->vptr->vector_elem(v, 1);
+		if(s->vptr->is_integer(o))
+			color = s->vptr->ivalue(o);
+		else if(s->vptr->is_string(o))
+			color = named_to_fltk_color(s->vptr->string_value(o), FL_BLACK);
+		else
+			continue;
+
+		VECTOR_GET_INT(s, v, 2, o, size);
+		VECTOR_GET_INT(s, v, 3, o, font);
+
+		if(STR_CMP(face, DEFAULT_FACE)) {
+			priv->push_style_default(color, font, size);
+		} else if((id = priv->faces.find(face)) >= 0) {
+			/* only faces some context uses get a place in style table */
+			face_pos[id] = priv->push_style(color, font, size);
+			printf("Loading face: %s %c\n", face, 'A' + face_pos[id]);
+		}
+	}
+
+	/*
+	 * Assign position and paint character to contexts. With this multiple entries with the same face, but different
+	 * token matchers will have the same paint character and position inside FLTK style table. Contexts with face
+	 * not found in face table are painted with default face.
+	 */
+	for(ContextTable *ct = priv->ctable; ct; ct = ct->next) {
+		/* FIXME: we adjust character here; move it to somewhere more visible */
+		ct->pos = (ct->face_id >= 0 && face_pos[ct->face_id] >= 0) ? face_pos[ct->face_id] : 0;
+		ct->chr = 'A' + ct->pos;
+	}
+
+	delete [] face_pos;
+	return priv;
+}
+
+/* mark 'bit' in eol states of all lines ending inside [from, to) and advance 'line' and 'lp' (position where line was counted) */
+static void hi_mark_lines(const char *text, int from, int to, const char *&lp, int &line, unsigned int *eol, unsigned int bit) {
+	const char *p, *end = text + to;
+
+	/* count lines up to the block start */
+	line += hi_scan_count_lines(lp, (text + from) - lp);
+
+	for(p = text + from; (p = (const char*)memchr(p, '\n', end - p)) != NULL; p++)
+		eol[line++] |= bit;
+
+	lp = end;
+}
+
+#if USE_DFA_REGEX
+/*
+ * Painting for CONTEXT_ENGINE_COMBINED: text is scanned once and the leftmost-longest match of any context is painted
+ * (on equal length, later context wins). Scanning continues after the match, so e.g. comment start inside string is
+ * never seen. Only one block (or string) can be open, as block is painted up to its ending token before scanning
+ * continues.
+ */
+static void hi_parse_combined(Fl_Highlight_Editor_P *priv, HiScratch *sc, const char *text, char *style, int len,
+							  unsigned int state, unsigned int *eol)
+{
+	HiLiteral     *ac   = priv->literals;
+	HiLiteralHits *hits = &sc->hits;
+	ContextTable  *it   = NULL;
+	HiRegexScan   scan;
+	const char    *lp = text;
+	int start = 0, end, from = 0, line = 0, j;
+
+	hi_regex_scan_begin(&scan, sc->combined ? sc->combined : priv->combined, text, len);
+
+	/* block opened on some of previous lines; paint it from region start */
+	if(state) {
+		for(it = priv->ctable; it && !(it->state & state); it = it->next)
+			;
+	}
+
+	while(true) {
+		if(!it) {
+			if(!hi_regex_scan_next(&scan, &start, &end)) break;
+
+			it   = priv->combined_ctx[scan.tag];
+			from = end;
+
+			if(it->type != CONTEXT_TYPE_BLOCK && it->type != CONTEXT_TYPE_STRING) {
+				memset(style + start, it->chr, end - start);
+
+				it = NULL;
+				continue;
+			}
+		}
+
+		bool closed;
+
+		if(it->type == CONTEXT_TYPE_STRING) {
+			end = hi_token_string(text, from, len, it->object.string.delim, ac->plen[it->literal[0]],
+								  it->object.string.escape, it->object.string.line, &closed);
+			closed = !closed;
+
+			/* single line string without its end is not painted; scanning continues after the delimiter */
+			if(end < 0) {
+				it = NULL;
+				continue;
+			}
+		} else {
+			/* first ending token after starting one; hits are sorted */
+			int *epos = hits->pos[it->literal[1]], lo = 0, hi = hits->count[it->literal[1]];
+			while(lo < hi) {
+				j = (lo + hi) / 2;
+				if(epos[j] < from) lo = j + 1;
+				else               hi = j;
+			}
+
+			closed = lo < hits->count[it->literal[1]];
+			end = closed ? epos[lo] + ac->plen[it->literal[1]] : len;
+		}
+
+		memset(style + start, it->chr, end - start);
+
+		if(eol && it->state) {
+			hi_mark_lines(text, start, end, lp, line, eol, it->state);
+			if(!closed) eol[line] |= it->state;
+		}
+
+		if(!closed) break;
+
+		scan.pos = end;
+		it = NULL;
+	}
+}
+#endif
+
+/*
+ * Paint 'n' bytes at 'style' with 'chr', except those already claimed. CONTEXT_ENGINE_OVERLAY runs rules from the last
+ * one (which wins) and every rule gets only bytes still 0, so result is the same as if every rule painted over the
+ * previous ones, but rules with lower priority are not matched where nothing is left for them (see HiRuleSpan).
+ */
+static inline void hi_claim(char *style, char chr, int n) {
+	const unsigned long long low = 0x7f7f7f7f7f7f7f7fULL, fill = 0x0101010101010101ULL * (unsigned char)chr;
+	unsigned long long v, zero;
+	int i = 0;
+
+	/* 8 bytes at once and without branches: high bit of every zero byte is moved down and spread over the byte */
+	for(; i + 8 <= n; i += 8) {
+		memcpy(&v, style + i, 8);
+		zero = (~(((v & low) + low) | v) & ~low) >> 7;
+		v |= fill & (zero * 0xff);
+		memcpy(style + i, &v, 8);
+	}
+
+	for(; i < n; i++)
+		style[i] = style[i] ? style[i] : chr;
+}
+
+/*
+ * Paint keywords, numbers or identifiers of context 'it' found by HiKeywords::scan(). With 'gaps', only words no other
+ * context painted are painted, which is how CONTEXT_ENGINE_COMBINED treats them: keyword inside string or comment is
+ * not a keyword; otherwise words are claimed.
+ */
+static void hi_paint_words(ContextTable *it, HiLiteralHits *words, char *style, bool gaps) {
+	int *pos = words->pos[it->object.keywords], n = words->count[it->object.keywords], i, j;
+
+	for(i = 0; i < n; i += 2) {
+		if(gaps) {
+			for(j = pos[i]; j < pos[i + 1] && style[j] == 'A'; j++)
+				;
+			if(j < pos[i + 1]) continue;
+
+			memset(style + pos[i], it->chr, pos[i + 1] - pos[i]);
+		} else {
+			hi_claim(style + pos[i], it->chr, pos[i + 1] - pos[i]);
+		}
+	}
+}
+
+/* monotonic time in microseconds, for rule budgets */
+static long long hi_clock_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* note that rule 'ctx' ran over budget; it will be disabled by hi_disable_rules() */
+static void hi_rule_overrun(HiScratch *sc, ContextTable *ctx, long long spent, int len) {
+	HiRuleDiag *d = new HiRuleDiag;
+	d->ctx  = ctx;
+	d->mode = d->rule = d->face = NULL;
+	d->ms   = (int)(spent / 1000);
+	d->len  = len;
+	d->next = sc->overrun;
+	sc->overrun = d;
+}
+
+/*
+ * Disable rules hi_parse() found too slow with 'sc' and move them to the diagnostics list. Done after matching, by
+ * the thread holding PARSE_LOCK, so threads highlighting at the same time don't see rules changing under them.
+ */
+static void hi_disable_rules(Fl_Highlight_Editor_P *priv, HiScratch *sc) {
+	HiRuleDiag *d, *nx;
+
+	for(d = sc->overrun; d; d = nx) {
+		nx = d->next;
+
+		/* the same rule can be reported by more than one chunk */
+		if(d->ctx->disabled) {
+			d->next = NULL;
+			free_rule_diags(d);
+			continue;
+		}
+
+		d->ctx->disabled = true;
+		d->mode = priv->ctable_mode ? strdup(priv->ctable_mode) : NULL;
+		d->rule = strdup(d->ctx->object.rx->pattern);
+		d->face = d->ctx->face ? strdup(d->ctx->face) : NULL;
+
+		printf("Warning: rule '%s' took %i ms on %i bytes, disabling it for this buffer\n", d->rule, d->ms, d->len);
+
+		d->next = priv->diagnostics;
+		priv->diagnostics = d;
+
+		/* cached lines were painted with the rule */
+		priv->line_cache.clear();
+	}
+
+	sc->overrun = NULL;
+}
+
+#if USE_REGEX
+/*
+ * Parts of the region regex rule is matched on: whole lines with any of rule's literals, lines closer than
+ * RULE_SPAN_GAP joined. Rule without literals has the whole region as its only span. Lines rules with higher priority
+ * already claimed entirely are left out of spans too (see hi_claim()). Matches never cross lines, so the result is the
+ * same as matching the whole region.
+ */
+struct HiRuleSpan {
+	const Regex *rx;
+	const char  *text, *style;
+	int len, from;
+	int lstart, lend; /* lines with literals, split into spans by claimed lines */
+	int start, end;   /* current span; 'end' is at newline or at 'len' */
+	int scanned;      /* bytes in spans so far */
+	int next[HI_REGEX_MAX_LITERALS]; /* next position of every literal; 'len' if there is none */
+	HiByteSet bytes; /* literals, if they are all single bytes; searched for together */
+};
+
+static void hi_rule_span_begin(HiRuleSpan *sp, const Regex *rx, const char *text, const char *style, int len) {
+	sp->rx      = rx;
+	sp->text    = text;
+	sp->style   = style;
+	sp->len     = len;
+	sp->from    = 0;
+	sp->lstart  = 0;
+	sp->lend    = -1;
+	sp->start   = sp->end = 0;
+	sp->scanned = 0;
+
+	sp->bytes.clear();
+	for(int i = 0; i < rx->nlits; i++) {
+		sp->next[i] = -1;
+
+		if(rx->lit_len[i] == 1 && sp->bytes.nbytes >= 0)
+			sp->bytes.add(rx->lits[i][0]);
+		else
+			sp->bytes.nbytes = -1;
+	}
+}
+
+/* the first position of any literal at or after 'from'; every literal is searched for once per region */
+static int hi_rule_span_literal(HiRuleSpan *sp, int from) {
+	const Regex *rx = sp->rx;
+	const char  *p;
+	int best = sp->len;
+
+	if(sp->bytes.nbytes > 1) {
+		if(sp->next[0] < from)
+			sp->next[0] = from + hi_scan_bytes(&sp->bytes, sp->text + from, sp->len - from);
+		return sp->next[0];
+	}
+
+	for(int i = 0; i < rx->nlits; i++) {
+		if(sp->next[i] < from) {
+			if(rx->lit_len[i] == 1)
+				p = (const char*)memchr(sp->text + from, rx->lits[i][0], sp->len - from);
+			else
+				p = (const char*)memmem(sp->text + from, sp->len - from, rx->lits[i], rx->lit_len[i]);
+
+			sp->next[i] = p ? p - sp->text : sp->len;
+		}
+
+		if(sp->next[i] < best)
+			best = sp->next[i];
+	}
+
+	return best;
+}
+
+/* lines with rule's literals, as [lstart, lend) */
+static bool hi_rule_span_lines(HiRuleSpan *sp) {
+	const char *p, *text = sp->text;
+	int pos, end, len = sp->len;
+
+	if(sp->from > len) return false;
+
+	if(!sp->rx->nlits) {
+		sp->lstart = 0;
+		sp->lend   = len;
+		sp->from   = len + 1;
+		return true;
+	}
+
+	pos = hi_rule_span_literal(sp, sp->from);
+	if(pos >= len) {
+		sp->from = len + 1;
+		return false;
+	}
+
+	/* span starts at the beginning of the line with literal... */
+	for(p = text + pos; p > text + sp->from && p[-1] != '\n'; p--)
+		;
+	sp->lstart = p - text;
+
+	/* ...and ends with the last line whose literal is close to the previous one */
+	do {
+		p   = (const char*)memchr(text + pos, '\n', len - pos);
+		end = p ? p - text : len;
+		pos = (end < len) ? hi_rule_span_literal(sp, end + 1) : len;
+	} while(pos < len && pos - end <= RULE_SPAN_GAP);
+
+	sp->lend = end;
+	sp->from = end + 1;
+	return true;
+}
+
+/*
+ * Lines in [from, end) with some byte no rule claimed yet, joined while they follow each other (empty lines don't
+ * break the run), as [*start, *end). Newlines don't count, as matches never contain them.
+ */
+static bool hi_unclaimed_lines(const char *text, const char *style, int from, int *start, int *end) {
+	const char *p;
+	int i = from, le, ne;
+
+	for(;; i++) {
+		p = (const char*)memchr(style + i, 0, *end - i);
+		if(!p) return false;
+
+		i = p - style;
+		if(text[i] != '\n') break;
+	}
+
+	for(*start = i; *start > from && text[*start - 1] != '\n'; (*start)--)
+		;
+
+	p  = (const char*)memchr(text + i, '\n', *end - i);
+	le = p ? p - text : *end;
+
+	while(le < *end) {
+		p  = (const char*)memchr(text + le + 1, '\n', *end - le - 1);
+		ne = p ? p - text : *end;
+
+		if(ne > le + 1 && !memchr(style + le + 1, 0, ne - le - 1))
+			break;
+		le = ne;
+	}
+
+	*end = le;
+	return true;
+}
+
+static bool hi_rule_span_next(HiRuleSpan *sp) {
+	int start, end;
+
+	while(true) {
+		if(sp->lstart > sp->lend && !hi_rule_span_lines(sp))
+			return false;
+
+		end = sp->lend;
+		if(hi_unclaimed_lines(sp->text, sp->style, sp->lstart, &start, &end)) {
+			sp->start   = start;
+			sp->end     = end;
+			sp->lstart  = end + 1;
+			sp->scanned += (end < sp->len ? end + 1 : sp->len) - start;
+			return true;
+		}
+
+		sp->lstart = sp->lend + 1;
+	}
+}
+#endif
+
+#if USE_POSIX_REGEX
+/*
+ * Match 'rx' against 'len' bytes of 'line', starting at 'from'; 'line' doesn't have to be NUL terminated. Match offsets
+ * are relative to 'line' and '^' matches only when 'from' is 0.
+ */
+static bool hi_regexec_line(HiScratch *sc, regex_t *rx, const char *line, int len, int from, regmatch_t *m) {
+#if USE_REGEX_STARTEND
+	m->rm_so = from;
+	m->rm_eo = len;
+	return regexec(rx, line, 1, m, REG_STARTEND) != REG_NOMATCH;
+#else
+	/* line is copied to be NUL terminated when matching on it starts */
+	if(from == 0) {
+		if(len + 1 > sc->line_size) {
+			delete [] sc->line;
+			sc->line_size = (len + 1) * 2;
+			sc->line = new char[sc->line_size];
+		}
+
+		memcpy(sc->line, line, len);
+		sc->line[len] = '\0';
+	}
+
+	if(regexec(rx, sc->line + from, 1, m, from ? REG_NOTBOL : 0) == REG_NOMATCH)
+		return false;
+
+	m->rm_so += from;
+	m->rm_eo += from;
+	return true;
+#endif
+}
+#endif
+
+/*
+ * Perform highlighting based on loaded context data. 'text' is expected to start at the beginning of the line and
+ * 'state' is lexer state at the end of the previous line. If 'eol' was given, it must have room for every line inside
+ * 'text' (number of newlines + 1) and it will be filled with lexer state at the end of each line.
+ *
+ * 'text' doesn't have to be NUL terminated, so it can point inside Fl_Text_Buffer. 'sc' is matching state of the
+ * calling thread.
+ */
+static char *hi_parse(Fl_Highlight_Editor_P *priv, HiScratch *sc, const char *text, char *style, int len,
+					  unsigned int state, unsigned int *eol)
+{
+	ContextTable  *ct   = priv->ctable, *order_buf[RULE_ORDER_SIZE], **order = order_buf, *it;
+	HiLiteral     *ac   = priv->literals;
+	HiLiteralHits *hits = &sc->hits;
+	int nrules = 0, i;
+#if USE_DFA_REGEX
+	int ndfa = 0;
+#endif
+	/* time regex rule can still take on this region; see below */
+	long long budget = 0, started, spent = 0;
+
+	if(!ct || !ac) return NULL;
+
+	/* all literal tokens are found with single pass, and so are keywords */
+	ac->scan(text, len, hits);
+	if(priv->keywords) priv->keywords->scan(text, len, &sc->words);
+
+	if(eol)
+		memset(eol, 0, sizeof(unsigned int) * (hi_scan_count_lines(text, len) + 1));
+
+#if USE_DFA_REGEX
+	/*
+	 * Combined automaton runs regex rules together with the rest, so without them the mode is painted the way
+	 * CONTEXT_ENGINE_OVERLAY does it, where regex rules are skipped.
+	 */
+	if(priv->context_engine == CONTEXT_ENGINE_COMBINED && priv->tier < HI_TIER_NO_REGEX) {
+		/* repaint region with default style first */
+		memset(style, 'A', len);
+		hi_parse_combined(priv, sc, text, style, len, state, eol);
+
+		for(ContextTable *it = ct; it && priv->keywords; it = it->next) {
+			if(it->type == CONTEXT_TYPE_KEYWORDS || it->type == CONTEXT_TYPE_NUMBER || it->type == CONTEXT_TYPE_IDENTIFIER)
+				hi_paint_words(it, &sc->words, style, true);
+		}
+
+		return style;
+	}
+#endif
+
+	/* nothing is claimed yet; what is left at the end gets default style */
+	memset(style, 0, len);
+
+	/* rules with the highest priority (the last ones) run first */
+	for(it = ct; it; it = it->next) {
+		nrules++;
+#if USE_DFA_REGEX
+		if(it->type == CONTEXT_TYPE_REGEX && it->object.rx->dfa) ndfa++;
+#endif
+	}
+
+	if(nrules > RULE_ORDER_SIZE)
+		order = new ContextTable*[nrules];
+
+	for(it = ct, i = nrules; it; it = it->next)
+		order[--i] = it;
+
+	for(int r = 0; r < nrules; r++) {
+		it = order[r];
+		if(it->type == CONTEXT_TYPE_EXACT || it->type == CONTEXT_TYPE_TO_EOL) {
+			if(it->literal[0] == -1) continue;
+
+			int *pos = hits->pos[it->literal[0]], n = hits->count[it->literal[0]];
+			int start, end, last = 0, l = ac->plen[it->literal[0]];
+			const char *p;
+
+			/* hits are sorted; skip those overlapping already painted match */
+			for(int i = 0; i < n; i++) {
+				start = pos[i];
+				if(start < last) continue;
+
+				if(it->type == CONTEXT_TYPE_EXACT) {
+					end = start + l;
+				} else {
+					/* paint match from found token to the end of the line or buffer */
+					p   = (const char*)memchr(text + start, '\n', len - start);
+					end = p ? p - text : len;
+				}
+
+				hi_claim(style + start, it->chr, end - start);
+				last = end;
+			}
+		} else if(it->type == CONTEXT_TYPE_BLOCK) {
+			if(it->literal[0] == -1 || it->literal[1] == -1) continue;
+
+			int *spos = hits->pos[it->literal[0]], sn = hits->count[it->literal[0]];
+			int *epos = hits->pos[it->literal[1]], en = hits->count[it->literal[1]];
+			int slen  = ac->plen[it->literal[0]], elen = ac->plen[it->literal[1]];
+			int si = 0, ei = 0, start, from, end, line = 0;
+			const char *lp = text;
+
+			/* block was opened on some of previous lines, so search for the ending token from region start */
+			bool open = (state & it->state) != 0;
+
+			while(open || si < sn) {
+				if(open) {
+					start = from = 0;
+					open  = false;
+				} else {
+					start = spos[si];
+					from  = start + slen;
+				}
+
+				/* first ending token after starting one */
+				while(ei < en && epos[ei] < from)
+					ei++;
+
+				/* this will also handle the case when block end wasn't found, so it will paint to the end of the file */
+				end = (ei < en) ? epos[ei] + elen : len;
+				hi_claim(style + start, it->chr, end - start);
+
+				if(eol && it->state) {
+					hi_mark_lines(text, start, end, lp, line, eol, it->state);
+					/* block is still open at the end of region */
+					if(ei >= en) eol[line] |= it->state;
+				}
+
+				if(ei >= en) break;
+
+				/* next block starts after this one */
+				while(si < sn && spos[si] < end)
+					si++;
+			}
+		} else if(it->type == CONTEXT_TYPE_STRING) {
+			if(it->literal[0] == -1) continue;
+
+			int *pos = hits->pos[it->literal[0]], n = hits->count[it->literal[0]], dlen = ac->plen[it->literal[0]];
+			int i = 0, start, from, end, line = 0;
+			const char *lp = text;
+
+			/* string was opened on some of previous lines, so its content starts at region start */
+			bool open = (state & it->state) != 0;
+
+			while(open || i < n) {
+				if(open) {
+					start = from = 0;
+				} else {
+					start = pos[i];
+					from  = start + dlen;
+				}
+
+				end = hi_token_string(text, from, len, it->object.string.delim, dlen, it->object.string.escape,
+									  it->object.string.line, &open);
+
+				/* single line string without its end is not painted; next one can start after the delimiter */
+				if(end < 0) {
+					while(i < n && pos[i] < from)
+						i++;
+					continue;
+				}
+
+				hi_claim(style + start, it->chr, end - start);
+
+				if(eol && it->state) {
+					hi_mark_lines(text, start, end, lp, line, eol, it->state);
+					if(open) eol[line] |= it->state;
+				}
+
+				if(open) break;
+
+				/* delimiters inside the string are its content */
+				while(i < n && pos[i] < end)
+					i++;
+			}
+		} else if(it->type == CONTEXT_TYPE_KEYWORDS || it->type == CONTEXT_TYPE_NUMBER ||
+				  it->type == CONTEXT_TYPE_IDENTIFIER)
+		{
+			if(priv->keywords) hi_paint_words(it, &sc->words, style, false);
+		} else if(it->type == CONTEXT_TYPE_REGEX) {
+#if USE_REGEX
+			HiRuleSpan span;
+			bool over = false;
+#if USE_DFA_REGEX
+			/* automatons in 'sc' are numbered by rule, disabled or not; rules are run from the last one */
+			HiRegex *dfa = it->object.rx->dfa ? (sc->dfa ? sc->dfa[--ndfa] : it->object.rx->dfa) : NULL;
+#endif
+			if(it->disabled || priv->tier >= HI_TIER_NO_REGEX) continue;
+
+			/*
+			 * hi_parse() is called for every line or chunk as often as for the whole buffer, so the budget is for all
+			 * text rule was matched on since rules were enabled, and what it took on previous regions is taken from it
+			 */
+			if(priv->rule_budget > 0) {
+				long bytes = it->budget_bytes + len;
+
+				budget = (long long)priv->rule_budget * 1000 * (bytes / RULE_BUDGET_SIZE + 1) - it->budget_spent;
+				if(budget <= 0) budget = 1;
+			}
+
+			started = budget ? hi_clock_us() : 0;
+			hi_rule_span_begin(&span, it->object.rx, text, style, len);
+
+			while(!over && hi_rule_span_next(&span)) {
+#if USE_DFA_REGEX
+				/* match of line anchored rule can start only at line start, so nothing else is tried */
+				if(dfa && it->object.rx->anchored) {
+					const char *p;
+					int ls = span.start, mend, nlines = 0;
+
+					while(true) {
+						mend = hi_regex_match_at(dfa, text, span.end, ls);
+						if(mend > ls) hi_claim(style + ls, it->chr, mend - ls);
+
+						if(budget && ++nlines % RULE_CHECK_MATCHES == 0 && (spent = hi_clock_us() - started) > budget) {
+							over = true;
+							break;
+						}
+
+						p = (const char*)memchr(text + ls, '\n', span.end - ls);
+						if(!p) break;
+						ls = (p - text) + 1;
+					}
+
+					if(budget && !over && nlines < RULE_CHECK_MATCHES)
+						over = (spent = hi_clock_us() - started) > budget;
+
+					continue;
+				}
+
+				/* builtin engine never matches newline, so the whole span is matched at once */
+				if(dfa) {
+					HiRegexScan scan;
+					int mstart, mend, nmatches = 0;
+
+					hi_regex_scan_begin(&scan, dfa, text + span.start, span.end - span.start);
+					while(hi_regex_scan_next(&scan, &mstart, &mend)) {
+						hi_claim(style + span.start + mstart, it->chr, mend - mstart);
+
+						if(budget && ++nmatches % RULE_CHECK_MATCHES == 0 && (spent = hi_clock_us() - started) > budget) {
+							over = true;
+							break;
+						}
+					}
+
+					if(budget && !over && nmatches < RULE_CHECK_MATCHES)
+						over = (spent = hi_clock_us() - started) > budget;
+
+					continue;
+				}
+#endif
+#if USE_POSIX_REGEX
+				/*
+				 * Match line by line, so matches never cross line boundaries and the result for each line depends
+				 * only on its content; this is what allows hi_update() to re-lex only changed lines. How regexec()
+				 * works, we are continuously matching to get offsets; grouping submatches are ignored as no grouping
+				 * is used.
+				 */
+				regmatch_t pmatch[1];
+				const char *line, *le, *end = text + span.end;
+				int from, steps = 0;
+
+				for(line = text + span.start; line <= end && !over; line = le + 1) {
+					le = (const char*)memchr(line, '\n', end - line);
+					if(!le) le = end;
+
+					for(from = 0; from <= le - line && hi_regexec_line(sc, it->object.rx->posix, line, le - line, from, pmatch); ) {
+						ASSERT(pmatch[0].rm_so != -1);
+						ASSERT(pmatch[0].rm_eo != -1);
+
+						hi_claim(style + (line - text) + pmatch[0].rm_so, it->chr, pmatch[0].rm_eo - pmatch[0].rm_so);
+
+						/* empty match; move forward or we will loop forever */
+						from = (pmatch[0].rm_eo > from) ? pmatch[0].rm_eo : from + 1;
+
+						/* '^' can't match again on this line */
+						if(it->object.rx->anchored) break;
+
+						/* every regexec() call can look at the rest of the line */
+						if(budget && (steps += (le - line) - from) >= RULE_CHECK_STEPS) {
+							steps = 0;
+							if((spent = hi_clock_us() - started) > budget) {
+								over = true;
+								break;
+							}
+						}
+					}
+
+					if(budget && !over && (steps += le - line + 1) >= RULE_CHECK_STEPS) {
+						steps = 0;
+						over = (spent = hi_clock_us() - started) > budget;
+					}
+				}
+#endif
+			}
+
+			if(budget) {
+				if(!over) spent = hi_clock_us() - started;
+
+				if(over) hi_rule_overrun(sc, it, it->budget_spent + spent, (int)(it->budget_bytes + len));
+
+				__sync_fetch_and_add(&it->budget_spent, spent);
+				__sync_fetch_and_add(&it->budget_bytes, (long)len);
+			}
+
+			/* chunks of the same region can be highlighted at the same time */
+			__sync_fetch_and_add(&it->prof_bytes, (long)len);
+			__sync_fetch_and_add(&it->prof_skipped, (long)(len - span.scanned));
+#endif
+		}
+	}
+
+	hi_claim(style, 'A', len);
+
+	if(order != order_buf)
+		delete [] order;
+
+	/* other threads disable their rules when they are done; see hi_parse_parallel() */
+	if(sc == &priv->scratch) hi_disable_rules(priv, sc);
+	return style;
+}
+
+#if USE_HIGHLIGHT_THREAD
+/* give 'sc' own copies of automatons hi_parse() will use */
+static void hi_scratch_init(Fl_Highlight_Editor_P *priv, HiScratch *sc) {
+#if USE_DFA_REGEX
+	if(priv->context_engine == CONTEXT_ENGINE_COMBINED) {
+		sc->combined = hi_regex_clone(priv->combined);
+		return;
+	}
+
+	ContextTable *it;
+	int i = 0;
+
+	for(it = priv->ctable; it; it = it->next) {
+		if(it->type == CONTEXT_TYPE_REGEX && it->object.rx->dfa)
+			sc->ndfa++;
+	}
+
+	sc->dfa = new HiRegex*[sc->ndfa + 1];
+	for(it = priv->ctable; it; it = it->next) {
+		if(it->type == CONTEXT_TYPE_REGEX && it->object.rx->dfa)
+			sc->dfa[i++] = hi_regex_clone(it->object.rx->dfa);
+	}
+#endif
+}
+
+static void hi_scratch_free(HiScratch *sc) {
+#if USE_DFA_REGEX
+	for(int i = 0; i < sc->ndfa; i++)
+		hi_regex_free(sc->dfa[i]);
+	delete [] sc->dfa;
+	hi_regex_free(sc->combined);
+
+	sc->dfa = NULL;
+	sc->ndfa = 0;
+	sc->combined = NULL;
+#endif
+}
+
+/* part of the text highlighted by one thread in hi_parse_parallel() */
+struct HiChunk {
+	Fl_Highlight_Editor_P *priv;
+	HiScratch     scratch;
+	const char   *text;
+	char         *style;
+	int           len;
+	int           nlines; /* newlines in text + 1 */
+	unsigned int *eol;
+	pthread_t     thread;
+	bool          started;
+};
+
+static void *hi_chunk_main(void *data) {
+	HiChunk *c = (HiChunk*)data;
+
+	c->nlines = hi_scan_count_lines(c->text, c->len) + 1;
+
+	c->eol = new unsigned int[c->nlines];
+	hi_parse(c->priv, &c->scratch, c->text, c->style, c->len, 0, c->eol);
+	return NULL;
+}
+
+/*
+ * Chunk was highlighted as if no block was open before it, but 'state' says otherwise. Re-lex its first 'nlines'
+ * lines with the right state in growing steps, until line state becomes the same as the one chunk already has.
+ */
+static void hi_chunk_fixup(Fl_Highlight_Editor_P *priv, HiChunk *c, unsigned int state, int nlines) {
+	unsigned int *eol = new unsigned int[c->nlines + 1];
+	const char *p = c->text, *q, *end = c->text + c->len;
+	int  done = 0, step = 1, k, i;
+
+	while(done < nlines) {
+		k = (done + step <= nlines) ? step : nlines - done;
+
+		for(q = p, i = 0; i < k && q < end; i++) {
+			q = (const char*)memchr(q, '\n', end - q);
+			q = q ? q + 1 : end;
+		}
+
+		hi_parse(priv, &priv->scratch, p, c->style + (p - c->text), q - p, state, eol);
+
+		bool converged = (eol[k - 1] == c->eol[done + k - 1]);
+		memcpy(c->eol + done, eol, sizeof(unsigned int) * k);
+
+		if(converged) break;
+
+		state = eol[k - 1];
+		done += k;
+		p = q;
+		step *= 2;
+	}
+
+	delete [] eol;
+}
+
+/*
+ * The same as hi_parse(), but 'text' is split at line starts into 'nthreads' chunks highlighted at the same time.
+ * Every chunk is highlighted as if no block is open before it; chunks where that was wrong (e.g. one starting inside
+ * a comment) are fixed afterwards, so the result is the same.
+ *
+ * Except when regex rule runs over *editor-rule-budget*: where it is stopped depends on time, and chunks don't see
+ * time other chunks spent until they are done with the rule, so every chunk paints its own part of the text with it
+ * before it is disabled. Budgets are still checked, as a rule that runs for minutes would take as long in a thread.
+ */
+static void hi_parse_parallel(Fl_Highlight_Editor_P *priv, const char *text, char *style, int len, unsigned int state,
+							  unsigned int *eol, int nthreads)
+{
+	HiChunk *chunks = new HiChunk[nthreads];
+	int n, i, start = 0, end, line = 0, nlines;
+	const char *p;
+
+	for(n = 0; n < nthreads && start < len; n++) {
+		end = (n == nthreads - 1) ? len : start + (len - start) / (nthreads - n);
+		if(end < len) {
+			p   = (const char*)memchr(text + end, '\n', len - end);
+			end = p ? p - text + 1 : len;
+		}
+
+		chunks[n].priv  = priv;
+		chunks[n].text  = text + start;
+		chunks[n].style = style + start;
+		chunks[n].len   = end - start;
+		hi_scratch_init(priv, &chunks[n].scratch);
+		start = end;
+	}
+
+	/* the first chunk is done by this thread; if thread can't be started, chunk is done here too */
+	for(i = 1; i < n; i++) {
+		chunks[i].started = (pthread_create(&chunks[i].thread, NULL, hi_chunk_main, &chunks[i]) == 0);
+		if(!chunks[i].started)
+			hi_chunk_main(&chunks[i]);
+	}
+
+	hi_chunk_main(&chunks[0]);
+
+	for(i = 1; i < n; i++) {
+		if(chunks[i].started)
+			pthread_join(chunks[i].thread, NULL);
+	}
+
+	for(i = 0; i < n; i++) {
+		/* the last entry of every chunk but the last one is an empty line the next chunk starts with */
+		nlines = (i == n - 1) ? chunks[i].nlines : chunks[i].nlines - 1;
+
+		if(state) hi_chunk_fixup(priv, &chunks[i], state, nlines);
+
+		memcpy(eol + line, chunks[i].eol, sizeof(unsigned int) * nlines);
+		line += nlines;
+		state = chunks[i].eol[nlines - 1];
+
+		delete [] chunks[i].eol;
+		hi_disable_rules(priv, &chunks[i].scratch);
+		hi_scratch_free(&chunks[i].scratch);
+	}
+
+	delete [] chunks;
+}
+#endif
+
+/* make 'buf' hold at least 'n' items */
+static char *hi_reserve(char *&buf, int &size, int n) {
+	if(n > size) {
+		delete [] buf;
+		size = n * 2;
+		buf  = new char[size];
+	}
+
+	return buf;
+}
+
+static unsigned int *hi_reserve(unsigned int *&buf, int &size, int n) {
+	if(n > size) {
+		delete [] buf;
+		size = n * 2;
+		buf  = new unsigned int[size];
+	}
+
+	return buf;
+}
+
+/* first position in [start, end) stored after the gap of the buffer, or 'end' if the whole range is before it */
+static int hi_gap_pos(Fl_Text_Buffer *buf, int start, int end) {
+	const char *base = buf->address(start);
+	int lo = start + 1, hi = end - 1, mid;
+
+	if(end - start < 2 || buf->address(end - 1) == base + (end - 1 - start))
+		return end;
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(buf->address(mid) == base + (mid - start))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * The same as hi_parse(), but line by line, painting lines found in 'line_cache' from it and adding the others. Only
+ * done by the thread holding PARSE_LOCK, as the cache is shared.
+ */
+static void hi_parse_cached(Fl_Highlight_Editor_P *priv, const char *text, char *style, int len, unsigned int state,
+							unsigned int *eol)
+{
+	HiLineCache *cache = &priv->line_cache;
+	const char *p = text, *q, *end = text + len;
+	unsigned int after[2];
+	int line = 0, n;
+
+	for(; p < end; p = q, line++) {
+		q = (const char*)memchr(p, '\n', end - p);
+		q = q ? q + 1 : end;
+		n = q - p;
+
+		if(!cache->get(p, n, state, priv->ctable_hash, style + (p - text), &after[0])) {
+			hi_parse(priv, &priv->scratch, p, style + (p - text), n, state, after);
+			cache->add(p, n, state, priv->ctable_hash, style + (p - text), after[0]);
+		}
+
+		state = after[0];
+		if(eol) eol[line] = state;
+	}
+
+	/* empty line after the trailing newline keeps the state of the line before it */
+	if(eol && (len == 0 || text[len - 1] == '\n')) eol[line] = state;
+}
+
+/* hi_parse() of contiguous text; returns the number of newlines in it and sets 'state' to the state after the last one */
+static int hi_parse_part(Fl_Highlight_Editor_P *priv, const char *text, char *style, int len, unsigned int *state,
+						 unsigned int *eol, int nthreads)
+{
+	if(len <= 0) return 0;
+
+#if USE_HIGHLIGHT_THREAD
+	if(nthreads > 1 && len >= PARALLEL_MIN_SIZE)
+		hi_parse_parallel(priv, text, style, len, *state, eol, nthreads);
+	else
+#endif
+	if(priv->line_cache.capacity)
+		hi_parse_cached(priv, text, style, len, *state, eol);
+	else
+		hi_parse(priv, &priv->scratch, text, style, len, *state, eol);
+
+	int n = hi_scan_count_lines(text, len);
+
+	if(eol && n) *state = eol[n - 1];
+	return n;
+}
+
+/*
+ * hi_parse() of [start, end) of the buffer, reading the text where it is. Fl_Text_Buffer keeps text in two parts
+ * around the gap, so each part is highlighted on its own and only the line split by the gap is copied. 'start' must
+ * be at the line start and 'end' after newline or at the buffer end.
+ */
+static void hi_parse_buffer(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int start, int end, char *style,
+							unsigned int state, unsigned int *eol, int nthreads)
+{
+	if(!priv->ctable || !priv->literals) {
+		memset(style, 'A', end - start);
+		return;
+	}
+
+	int gap = hi_gap_pos(buf, start, end), ls, le, n;
+
+	if(gap == end) {
+		hi_parse_part(priv, buf->address(start), style, end - start, &state, eol, nthreads);
+		return;
+	}
+
+	/* parts continue with the state where the previous one stopped */
+	if(!eol) eol = hi_reserve(priv->eol_tmp, priv->eol_tmp_size, buf->count_lines(start, end) + 1);
+
+	ls = buf->line_start(gap);
+	le = ls;
+
+	if(ls != gap) {
+		le = buf->line_end(gap);
+		if(le < end) le++;
+
+		hi_reserve(priv->gap_line, priv->gap_line_size, le - ls);
+		memcpy(priv->gap_line, buf->address(ls), gap - ls);
+		memcpy(priv->gap_line + (gap - ls), buf->address(gap), le - gap);
+	}
+
+	n  = hi_parse_part(priv, buf->address(start), style, ls - start, &state, eol, nthreads);
+	n += hi_parse_part(priv, priv->gap_line, style + (ls - start), le - ls, &state, eol + n, 1);
+	hi_parse_part(priv, buf->address(le), style + (le - start), end - le, &state, eol + n, nthreads);
+}
+
+/* line number of 'pos'; counting is started from the closest known line start */
+static int hi_line_of(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int pos) {
+	int start = buf->line_start(pos), line;
+
+	if(start >= priv->line_hint_pos)
+		line = priv->line_hint_line + buf->count_lines(priv->line_hint_pos, start);
+	else
+		line = priv->line_hint_line - buf->count_lines(start, priv->line_hint_pos);
+
+	priv->line_hint_pos  = start;
+	priv->line_hint_line = line;
+	return line;
+}
+
+/* true if lines far from the edit or viewport are highlighted when idle or by background thread */
+static bool hi_background(Fl_Highlight_Editor_P *priv) {
+#if USE_HIGHLIGHT_THREAD
+	if(priv->use_thread) return true;
+#endif
+	return priv->idle_budget > 0;
+}
+
+/*
+ * Highlight 'nlines' lines from 'start', including the newline of the last one, with incoming 'state' and store styles.
+ * If given, 'eol' must have room for nlines + 1 states. Returns end of highlighted region.
+ */
+static int hi_lex_lines(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int start, int nlines, unsigned int state, unsigned int *eol) {
+	int end = buf->line_end(buf->skip_lines(start, nlines - 1));
+	if(end < buf->length()) end++;
+
+	char *style = hi_reserve(priv->style_tmp, priv->style_tmp_size, end - start);
+
+	PARSE_LOCK(priv);
+	hi_parse_buffer(priv, buf, start, end, style, state, eol, 1);
+	PARSE_UNLOCK(priv);
+
+	priv->store_styles(start, end - start, style);
+	return end;
+}
+
+/* highlight up to 'nlines' lines after 'lexed_line', moving it forward */
+static void hi_lex_ahead(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int nlines) {
+	if(priv->lexed_line + nlines > priv->line_state_last)
+		nlines = priv->line_state_last - priv->lexed_line;
+
+	if(nlines <= 0) return;
+
+	unsigned int *eol  = hi_reserve(priv->eol_tmp, priv->eol_tmp_size, nlines + 1);
+	unsigned int state = priv->lexed_line > 0 ? priv->line_state[priv->lexed_line - 1] : 0;
+
+	priv->lexed_pos = hi_lex_lines(priv, buf, priv->lexed_pos, nlines, state, eol);
+	memcpy(priv->line_state + priv->lexed_line, eol, sizeof(unsigned int) * nlines);
+	priv->lexed_line += nlines;
+}
+
+/*
+ * Make sure visible lines are highlighted. If they are close to 'lexed_line', it is moved past them; otherwise they
+ * are highlighted as if no block was open before them and will be fixed when 'lexed_line' reaches them.
+ */
+static void hi_lex_visible(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	if(priv->lexed_line >= priv->line_state_last) return;
+
+	int start, nlines, line;
+
+	priv->visible_lines(&start, &nlines);
+	line = hi_line_of(priv, buf, start);
+
+	if(line + nlines <= priv->lexed_line) return;
+
+	if(line <= priv->lexed_line + IDLE_CHUNK_LINES) {
+		hi_lex_ahead(priv, buf, line + nlines - priv->lexed_line);
+		return;
+	}
+
+	if(line == priv->spec_line) return;
+
+	if(line + nlines > priv->line_state_last)
+		nlines = priv->line_state_last - line;
+
+	hi_lex_lines(priv, buf, start, nlines, 0, NULL);
+	priv->spec_line = line;
+}
+
+/*
+ * Highlight visible lines of buffer highlighted only where it is seen (HI_TIER_VIEWPORT and HI_TIER_NO_REGEX), as if no
+ * block was open before them. Done again only after an edit or scroll.
+ */
+static void hi_lex_viewport(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	int start, nlines, line;
+
+	priv->visible_lines(&start, &nlines);
+	line = hi_line_of(priv, buf, start);
+
+	if(line == priv->spec_line) return;
+
+	if(line + nlines > priv->line_state_last)
+		nlines = priv->line_state_last - line;
+
+	/* display wasn't laid out yet */
+	if(nlines <= 0) return;
+
+	hi_lex_lines(priv, buf, start, nlines, 0, NULL);
+	priv->spec_line = line;
+}
+
+/* idle callback; continue highlighting from 'lexed_line' until the time budget was spent */
+static void hi_idle(void *data) {
+	Fl_Highlight_Editor_P *priv = (Fl_Highlight_Editor_P*)data;
+	Fl_Text_Buffer *buf = priv->self->buffer();
+	clock_t started = clock(), budget = (clock_t)priv->idle_budget * CLOCKS_PER_SEC / 1000;
+
+	/* lines before 'lexed_line' could be changed inside batch; end_batch() will schedule it again */
+	if(priv->batch) {
+		Fl::remove_idle(hi_idle, priv);
+		return;
+	}
+
+	/* user could scroll since the last call */
+	hi_lex_visible(priv, buf);
+
+	while(priv->lexed_line < priv->line_state_last) {
+		hi_lex_ahead(priv, buf, IDLE_CHUNK_LINES);
+		if(clock() - started >= budget) break;
+	}
+
+	if(priv->lexed_line >= priv->line_state_last)
+		Fl::remove_idle(hi_idle, priv);
+}
+
+#if USE_HIGHLIGHT_THREAD
+static void hi_publish(void *data);
+
+static void hi_worker_drop_job(HiWorker *w) {
+	free(w->text);
+	w->text = NULL;
+}
+
+static void *hi_worker_main(void *data) {
+	HiWorker *w = (HiWorker*)data;
+	char *p, *end;
+	int   nlines;
+
+	pthread_mutex_lock(&w->lock);
+
+	while(!w->quit) {
+		if(!w->text) {
+			pthread_cond_wait(&w->cond, &w->lock);
+			continue;
+		}
+
+		/* the next IDLE_CHUNK_LINES lines of the job, with newline of the last one */
+		p   = w->text + w->done;
+		end = w->text + w->len;
+
+		for(nlines = 0; nlines < IDLE_CHUNK_LINES && p < end; nlines++) {
+			p = (char*)memchr(p, '\n', end - p);
+			p = p ? p + 1 : end;
+		}
+
+		/* empty line after the last newline of the buffer */
+		if(w->at_end && p == end && nlines < IDLE_CHUNK_LINES && w->line + nlines < w->last)
+			nlines++;
+
+		if(w->job_revision != w->revision || !nlines) {
+			hi_worker_drop_job(w);
+			continue;
+		}
+
+		HiResult *r = new HiResult;
+		r->revision = w->job_revision;
+		r->pos      = w->pos + w->done;
+		r->len      = p - (w->text + w->done);
+		r->line     = w->line;
+		r->nlines   = nlines;
+		r->style    = new char[r->len + 1];
+		r->eol      = new unsigned int[nlines + 1];
+		r->next     = NULL;
+		r->style[r->len] = '\0';
+
+		hi_parse(w->priv, &w->priv->scratch, w->text + w->done, r->style, r->len, w->state, r->eol);
+
+		w->done  += r->len;
+		w->line  += nlines;
+		w->state  = r->eol[nlines - 1];
+
+		if(w->results_last)
+			w->results_last->next = r;
+		else
+			w->results = r;
+		w->results_last = r;
+
+		if(!w->awake_pending && Fl::awake(hi_publish, w) == 0) {
+			w->awake_pending = true;
+			w->refs++;
+		}
+
+		/* let UI thread parse and post new jobs */
+		pthread_mutex_unlock(&w->lock);
+		sched_yield();
+		pthread_mutex_lock(&w->lock);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void hi_worker_free_results(HiResult *r) {
+	for(HiResult *next; r; r = next) {
+		next = r->next;
+		delete [] r->style;
+		delete [] r->eol;
+		delete r;
+	}
+}
+
+/* drop reference; the last one frees the worker */
+static void hi_worker_unref(HiWorker *w) {
+	pthread_mutex_lock(&w->lock);
+	bool last = (--w->refs == 0);
+	pthread_mutex_unlock(&w->lock);
+
+	if(!last) return;
+
+	hi_worker_drop_job(w);
+	hi_worker_free_results(w->results);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	delete w;
+}
+
+static HiWorker *hi_worker_start(Fl_Highlight_Editor_P *priv) {
+	HiWorker *w = new HiWorker;
+	w->priv  = priv;
+	w->quit  = false;
+	w->refs  = 1;
+	w->revision = priv->revision;
+	w->text  = NULL;
+	w->pos   = w->line = w->len = w->done = w->last = 0;
+	w->at_end = false;
+	w->state = w->job_revision = 0;
+	w->results = w->results_last = NULL;
+	w->awake_pending = false;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	/* initialize FLTK thread support, needed by Fl::awake() */
+	Fl::lock();
+	Fl::unlock();
+
+	if(pthread_create(&w->thread, NULL, hi_worker_main, w) != 0) {
+		puts("Unable to start highlighting thread; highlighting when idle");
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		delete w;
+		return NULL;
+	}
+
+	return w;
+}
+
+static void hi_worker_stop(Fl_Highlight_Editor_P *priv) {
+	HiWorker *w = priv->worker;
+	if(!w) return;
+
+	pthread_mutex_lock(&w->lock);
+	w->quit = true;
+	w->priv = NULL;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_join(w->thread, NULL);
+	priv->worker = NULL;
+
+	/* hi_publish() could still be queued */
+	hi_worker_unref(w);
+}
+
+/* give the thread lines after 'lexed_line', unless it already works on them for the current revision */
+static void hi_worker_post(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	HiWorker *w = priv->worker;
+
+	pthread_mutex_lock(&w->lock);
+	w->revision = priv->revision;
+
+	if(priv->lexed_line < priv->line_state_last && (!w->text || w->job_revision != w->revision)) {
+		int end = priv->lexed_pos + THREAD_SNAPSHOT_SIZE;
+
+		if(end >= buf->length())
+			end = buf->length();
+		else
+			end = buf->skip_lines(end, 1);
+
+		hi_worker_drop_job(w);
+		w->text   = buf->text_range(priv->lexed_pos, end);
+		w->pos    = priv->lexed_pos;
+		w->line   = priv->lexed_line;
+		w->len    = end - priv->lexed_pos;
+		w->done   = 0;
+		w->at_end = (end == buf->length());
+		w->last   = priv->line_state_last;
+		w->state  = priv->lexed_line > 0 ? priv->line_state[priv->lexed_line - 1] : 0;
+		w->job_revision = w->revision;
+		pthread_cond_signal(&w->cond);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+}
 #endif
 
-	float diff = (((float)clock() - (float)started) / CLOCKS_PER_SEC) * 1000;
-	printf("Interpreter booted in %4.1fms.\n", diff);
+static void hi_schedule(Fl_Highlight_Editor_P *priv) {
+#if USE_HIGHLIGHT_THREAD
+	if(priv->use_thread && !priv->worker)
+		priv->worker = hi_worker_start(priv);
 
-	if(do_repl)
-		scheme_load_named_file(scm, stdin, 0);
+	if(priv->worker) {
+		hi_worker_post(priv, priv->self->buffer());
+		return;
+	}
+#endif
 
-	priv->scm = scm;
+	if(priv->lexed_line < priv->line_state_last && !Fl::has_idle(hi_idle, priv))
+		Fl::add_idle(hi_idle, priv);
 }
 
-void Fl_Highlight_Editor::load_script_file(const char *path) {
-	if(!priv) return;
-	FILE *fd = fopen(path, "r");
-	if(!fd) return;
+#if USE_HIGHLIGHT_THREAD
+/* called in UI thread by Fl::awake(); store results of the current revision that continue where 'lexed_line' is */
+static void hi_publish(void *data) {
+	HiWorker *w = (HiWorker*)data;
+	HiResult *results;
+	Fl_Highlight_Editor_P *priv;
 
-	scheme_load_named_file(priv->scm, fd, path);
-	fclose(fd);
-}
+	pthread_mutex_lock(&w->lock);
+	results = w->results;
+	w->results = w->results_last = NULL;
+	w->awake_pending = false;
+	priv = w->priv;
+	pthread_mutex_unlock(&w->lock);
 
-void Fl_Highlight_Editor::load_script_string(const char *str) {
-	if(!priv) return;
-	scheme_load_string(priv->scm, str);
-}
+	if(priv) {
+		for(HiResult *r = results; r; r = r->next) {
+			if(r->revision != priv->revision) continue;
 
-const char *Fl_Highlight_Editor::script_folder(void) {
-	if(!priv) return NULL;
-	return priv->script_path;
+			if(r->line != priv->lexed_line || r->pos != priv->lexed_pos || r->line + r->nlines > priv->line_state_last) {
+				/* UI thread highlighted some of these lines meanwhile; start again from 'lexed_line' */
+				priv->revision++;
+				break;
+			}
+
+			priv->store_styles(r->pos, r->len, r->style);
+			memcpy(priv->line_state + r->line, r->eol, sizeof(unsigned int) * r->nlines);
+
+			priv->lexed_line += r->nlines;
+			priv->lexed_pos  += r->len;
+		}
+
+		/* user could scroll since the last call */
+		hi_lex_visible(priv, priv->self->buffer());
+		hi_schedule(priv);
+	}
+
+	hi_worker_free_results(results);
+	hi_worker_unref(w);
 }
+#endif
 
-static Fl_Highlight_Editor_P *load_context_table(Fl_Highlight_Editor_P *priv) {
+/* the first tier of *editor-large-file-thresholds* entries whose size or number of lines text with 'len' bytes reached */
+static int hi_choose_tier(Fl_Highlight_Editor_P *priv, int len, int nlines) {
 	scheme *s = priv->scm;
-	pointer tp, f, v, style_table = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-context-table*"));
-	char *face;
+	pointer lst = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-large-file-thresholds*")), e, v;
+	int tier = HI_TIER_FULL, t, limit[2];
 
-	for(pointer it = style_table; it != s->NIL; it = s->vptr->pair_cdr(it)) {
-		v = s->vptr->pair_car(it);
+	for(; s->vptr->is_pair(lst); lst = s->vptr->pair_cdr(lst)) {
+		e = s->vptr->pair_car(lst);
+		if(!s->vptr->is_pair(e) || !s->vptr->is_symbol(s->vptr->pair_car(e))) continue;
 
-		if(!s->vptr->is_vector(v))
-			continue;
+		for(t = 0; hi_tier_names[t] && !STR_CMP(hi_tier_names[t], s->vptr->symname(s->vptr->pair_car(e))); t++)
+			;
 
-		if(s->vptr->vector_length(v) != 3) {
-			printf("Expected vector len of 3 but got len '%i'\n", (int)s->vptr->vector_length(v));
+		if(!hi_tier_names[t]) {
+			printf("Warning: unknown highlight tier '%s'\n", s->vptr->symname(s->vptr->pair_car(e)));
 			continue;
 		}
 
-		/* fetch type */
-		tp = s->vptr->vector_elem(v, 0);
-		if(!s->vptr->is_integer(tp))
-			continue;
-
-		/* fetch face; we limit ourself face must be either symbol or string */
-		f = s->vptr->vector_elem(v, 2);
-		if(!s->vptr->is_symbol(f) && !s->vptr->is_string(f))
-			continue;
+		/* bytes and lines; missing or #f is no limit */
+		e = s->vptr->pair_cdr(e);
+		for(int i = 0; i < 2; i++) {
+			v = s->vptr->is_pair(e) ? s->vptr->pair_car(e) : s->F;
+			limit[i] = s->vptr->is_integer(v) ? s->vptr->ivalue(v) : 0;
+			e = s->vptr->is_pair(e) ? s->vptr->pair_cdr(e) : s->NIL;
+		}
 
-		face = s->vptr->is_symbol(f) ? s->vptr->symname(f) : s->vptr->string_value(f);
-		priv->push_context(s, s->vptr->ivalue(tp), s->vptr->vector_elem(v, 1), face);
+		if(t > tier && ((limit[0] > 0 && len >= limit[0]) || (limit[1] > 0 && nlines >= limit[1])))
+			tier = t;
 	}
 
-	return priv;
+	return tier;
 }
 
-#define VECTOR_GET_INT(scm, vec, pos, tmp, ret)	\
-do {											\
-	tmp = scm->vptr->vector_elem(vec, pos);		\
-	if(!s->vptr->is_integer(tmp)) continue;		\
-	ret = s->vptr->ivalue(tmp);					\
-} while(0)
+/* show the whole buffer in default face */
+static void hi_reset_styles(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	if(priv->stylebuf) {
+		char *style = new char[buf->length() + 1];
+		memset(style, 'A', buf->length());
+		style[buf->length()] = '\0';
 
-static Fl_Highlight_Editor_P *load_face_table(Fl_Highlight_Editor_P *priv) {
-	scheme *s = priv->scm;
-	const char *face;
-	pointer o, v, face_table = scheme_eval(s, s->vptr->mk_symbol(s, "*editor-face-table*"));
-	int font = 0, color = 0, size = 0;
+		priv->stylebuf->text(style);
+		delete[] style;
+	}
 
-	for(pointer it = face_table; it != s->NIL; it = s->vptr->pair_cdr(it)) {
-		v = s->vptr->pair_car(it);
+	priv->styles.clear();
+	priv->styles.fill(0, 0, 'A', buf->length());
+	priv->stale.clear();
+}
 
-		if(!s->vptr->is_vector(v) || s->vptr->vector_length(v) != 4)
-			continue;
+/*
+ * Give the display style of every byte, or none in HI_TIER_PLAIN: there everything is in default face, so it is drawn
+ * with widget's text font and color, set from that face, and style buffer as large as the text is not kept.
+ */
+static void hi_display_styles(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	Fl_Highlight_Editor *self = priv->self;
 
-		o = s->vptr->vector_elem(v, 0);
-		if(!s->vptr->is_symbol(o) && !s->vptr->is_string(o))
-			continue;
+	if(priv->tier != HI_TIER_PLAIN) {
+		if(priv->stylebuf) return;
 
-		face = s->vptr->is_string(o) ? s->vptr->string_value(o) : s->vptr->symname(o);
+		priv->stylebuf = new HiStyleBuffer(buf->length());
+		self->highlight_data(priv->stylebuf, priv->styletable, priv->styletable_last, 'A', 0, 0);
+		return;
+	}
 
-		/* we support both FLTK and html colors */
-		o = s->vptr->vector_elem(v, 1);
-		if(s->vptr->is_integer(o))
-			color = s->vptr->ivalue(o);
-		else if(s->vptr->is_string(o))
-			color = named_to_fltk_color(s->vptr->string_value(o), FL_BLACK);
-		else
-			continue;
+	self->textfont(priv->styletable[0].font);
+	self->textsize(priv->styletable[0].size);
+	self->textcolor(priv->styletable[0].color);
 
-		VECTOR_GET_INT(s, v, 2, o, size);
-		VECTOR_GET_INT(s, v, 3, o, font);
+	if(!priv->stylebuf) return;
 
-		if(STR_CMP(face, DEFAULT_FACE)) {
-			priv->push_style_default(color, font, size);
-		} else {
-			/* Lookup face in face table and assign position and paint character. This could be done much efficiently with hash table... */
-			for(ContextTable *ct = priv->ctable; ct; ct = ct->next) {
-				if(ct->face && STR_CMP(ct->face, face)) {
-					ct->pos = priv->push_style(color, font, size);
-
-					/* FIXME: we adjust character here; move it to somewhere more visible */
-					ct->chr = 'A' + ct->pos;
-					printf("Loading face: %s %c\n", ct->face, ct->chr);
-
-					/*
-					 * Now scan remaining elements and find entries with the same face and adjust thier 'pos' and 'chr' members. With this
-					 * multiple entries with the same face, but different token matchers will have the same paint character and position inside
-					 * FLTK style table.
-					 */
-					for(ContextTable *tmp = ct; tmp; tmp = tmp->next) {
-						if(STR_CMP(ct->face, tmp->face)) {
-							tmp->pos = ct->pos;
-							tmp->chr = ct->chr;
-						}
-					}
+	self->highlight_data(NULL, priv->styletable, priv->styletable_last, 'A', 0, 0);
+	delete priv->stylebuf;
+	priv->stylebuf = NULL;
+}
 
-					/* done, go home */
-					break;
-				}
-			}
-		}
-	}
+/* highlighting functions and callbacks */
+static void hi_init(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	/* do nothing unless we have something inside style table */
+	if(!priv->styletable_size)
+		return;
 
-	return priv;
-}
+	char *style;
+	int  nthreads = 1;
 
-/* perform highlighting based on loaded context data */
-static char *hi_parse(ContextTable *ct, const char *text, char *style, int len) {
-	if(!ct) return NULL;
+	priv->line_hint_pos = priv->line_hint_line = 0;
+	priv->line_state_last = 0;
+	priv->resize_line_states(buf->count_lines(0, buf->length()) + 1);
+	priv->spec_line = -1;
 
-	/* repaint region with default style first */
-	memset(style, 'A', len);
+	pointer v = scheme_eval(priv->scm, priv->scm->vptr->mk_symbol(priv->scm, "*editor-idle-highlight-budget*"));
+	priv->idle_budget = priv->scm->vptr->is_integer(v) ? priv->scm->vptr->ivalue(v) : 0;
 
-	for(ContextTable *it = ct; it; it = it->next) {
-		if(it->type == CONTEXT_TYPE_EXACT || it->type == CONTEXT_TYPE_TO_EOL) {
-			const char *p, *what = it->object.exact;
-			int start, l = strlen(what);
+	v = scheme_eval(priv->scm, priv->scm->vptr->mk_symbol(priv->scm, "*editor-rule-budget*"));
+	priv->rule_budget = priv->scm->vptr->is_integer(v) ? priv->scm->vptr->ivalue(v) : 0;
 
-			if(it->type == CONTEXT_TYPE_EXACT) {
-				for(p = strstr(text, what); p; p = strstr(p + l, what)) {
-					start = p - text;
+	v = scheme_eval(priv->scm, priv->scm->vptr->mk_symbol(priv->scm, "*editor-max-line-length*"));
+	priv->max_line_length = priv->scm->vptr->is_integer(v) ? priv->scm->vptr->ivalue(v) : 0;
 
-					for(int i = start; i < (start + l); i++)
-						style[i] = it->chr;
-				}
-			} else {
-				p = text;
-				/* paint match from found token to the end of the line or buffer */
-				for(p = strstr(text, what); p; p = strstr(p, what)) {
-					start = p - text;
-
-					for(int i = start; *p && *p != '\n'; i++, p++)
-						style[i] = it->chr;
-				}
-			}
-		} else if(it->type == CONTEXT_TYPE_BLOCK) {
-			const char *bstart, *bend, *p, *e;
-			int slen;
+	v = scheme_eval(priv->scm, priv->scm->vptr->mk_symbol(priv->scm, "*editor-line-cache-size*"));
+	PARSE_LOCK(priv);
+	priv->line_cache.resize(priv->scm->vptr->is_integer(v) ? priv->scm->vptr->ivalue(v) : 0);
+	PARSE_UNLOCK(priv);
 
-			bstart = it->object.block[0];
-			bend   = it->object.block[1];
-			slen   = strlen(bstart);
+	/* results of background thread are not valid any more */
+	priv->revision++;
 
-			for(p = strstr(text, bstart); p; p = strstr(p, bstart)) {
-				e = strstr(p + slen, bend);
+	/* file being loaded will choose its own tier once it is in the buffer */
+	int tier = priv->loading ? HI_TIER_PLAIN : hi_choose_tier(priv, buf->length(), priv->line_state_last);
 
-				/* this will also handle the case when block end wasn't found, so it will paint to the end of the file */
-				for(int i = p - text; *p; p++, i++) {
-					style[i] = it->chr;
-					if(p == e) {
-						/* paint ending character too */
-						style[++i] = it->chr;
-						break;
-					}
-				}
+	if(tier != priv->tier) {
+		/* cached lines could be highlighted without regex rules */
+		PARSE_LOCK(priv);
+		priv->line_cache.clear();
+		PARSE_UNLOCK(priv);
+		priv->tier = tier;
+	}
 
-				if(!*p) break;
-				p += slen;
-			}
-		} else if(it->type == CONTEXT_TYPE_REGEX) {
-#if USE_POSIX_REGEX
-			/*
-			 * Match against the whole text. However, how regexec() works, we are continuously
-			 * matching to get offsets; grouping submatches are ignored as no grouping is used.
-			 */
-			regmatch_t pmatch[1];
-			const char *str = text;
-			int i, end;
-
-			for(str = text; regexec(it->object.rx, str, 1, pmatch, 0) != REG_NOMATCH; str += pmatch[0].rm_eo) {
-				ASSERT(pmatch[0].rm_so != -1);
-				ASSERT(pmatch[0].rm_eo != -1);
-
-				i   = str - text + pmatch[0].rm_so - 1;
-				end = str - text + pmatch[0].rm_eo - 1;
-				while(i++ < end)
-					style[i] = it->chr;
-			}
+#if USE_HIGHLIGHT_THREAD
+	v = scheme_eval(priv->scm, priv->scm->vptr->mk_symbol(priv->scm, "*editor-highlight-thread*"));
+	priv->use_thread = (v != priv->scm->F && v != priv->scm->NIL);
+
+	if(!priv->use_thread)
+		hi_worker_stop(priv);
 #endif
-		}
+
+	hi_display_styles(priv, buf);
+
+	/* only what is seen is highlighted, so there is nothing for idle callback or background thread */
+	if(priv->tier != HI_TIER_FULL) {
+		hi_reset_styles(priv, buf);
+
+		priv->lexed_line = priv->line_state_last;
+		priv->lexed_pos  = buf->length();
+
+		if(priv->tier != HI_TIER_PLAIN && priv->ctable)
+			hi_lex_viewport(priv, buf);
+		return;
 	}
 
-	return style;
-}
+	if(hi_background(priv) && priv->ctable && priv->line_state_last > IDLE_CHUNK_LINES) {
+		/* show everything in default face and let visible lines and idle callback do the work */
+		hi_reset_styles(priv, buf);
 
-/* highlighting functions and callbacks */
-static void hi_init(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
-	/* do nothing unless we have something inside style table */
-	if(!priv->styletable_size)
+		priv->lexed_line = priv->lexed_pos = 0;
+		hi_lex_visible(priv, buf);
+		hi_schedule(priv);
 		return;
+	}
 
-	char *style, *text;
+#if USE_HIGHLIGHT_THREAD
+	v = scheme_eval(priv->scm, priv->scm->vptr->mk_symbol(priv->scm, "*editor-parallel-highlight*"));
+	nthreads = priv->scm->vptr->is_integer(v) ? priv->scm->vptr->ivalue(v) : 1;
+
+	if(nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
 
 	style = new char[buf->length() + 1];
-	text = buf->text();
 
 	/* the first style is always marked with 'A' */
 	style[buf->length()] = '\0';
 
-	if(!priv->stylebuf)
-		priv->stylebuf = new Fl_Text_Buffer(buf->length());
+	PARSE_LOCK(priv);
+	hi_parse_buffer(priv, buf, 0, buf->length(), style, 0, priv->line_state, nthreads);
+	PARSE_UNLOCK(priv);
 
-	hi_parse(priv->ctable, text, style, buf->length());
+	priv->lexed_line = priv->line_state_last;
+	priv->lexed_pos  = buf->length();
+
+	priv->styles.clear();
+	priv->styles.replace(0, 0, style, buf->length());
+	priv->stale.clear();
 
 	priv->stylebuf->text(style);
 	delete[] style;
-	free(text);
+	priv->trim_scratch();
+}
+
+/* how many of 'nlines' lines from 'start' come before the first one longer than *editor-max-line-length* */
+static int hi_short_lines(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int start, int nlines) {
+	if(priv->max_line_length <= 0) return nlines;
+
+	int i, end;
+	for(i = 0; i < nlines; i++, start = end + 1) {
+		end = buf->line_end(start);
+		if(end - start > priv->max_line_length) break;
+	}
+
+	return i;
+}
+
+/*
+ * Highlight [start, end) of a line on its own and store styles. Text is copied if it is split by the gap, as
+ * hi_parse_buffer() can only split it at line starts. 'state' is the state at 'start'.
+ */
+static void hi_lex_window(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int start, int end, unsigned int state) {
+	char *style = hi_reserve(priv->style_tmp, priv->style_tmp_size, end - start);
+	const char *text = buf->address(start);
+	int gap = hi_gap_pos(buf, start, end);
+
+	if(gap < end) {
+		hi_reserve(priv->gap_line, priv->gap_line_size, end - start);
+		memcpy(priv->gap_line, buf->address(start), gap - start);
+		memcpy(priv->gap_line + (gap - start), buf->address(gap), end - gap);
+		text = priv->gap_line;
+	}
+
+	PARSE_LOCK(priv);
+	if(priv->literals)
+		hi_parse(priv, &priv->scratch, text, style, end - start, state, NULL);
+	else
+		memset(style, 'A', end - start);
+	PARSE_UNLOCK(priv);
+
+	priv->store_styles(start, end - start, style);
+}
+
+/*
+ * Re-highlight line from 'start' that is longer than *editor-max-line-length*, after 'len' bytes at 'pos' were
+ * changed. Highlighting the whole line on every key press would make editing minified files crawl, so only
+ * LONG_LINE_WINDOW bytes around the edit and around the visible part of the line are done, and styles of the rest are
+ * kept. The part of the line that is visible is not known without wrapping, as it depends on horizontal scroll; the
+ * display keeps the cursor visible, so text around it is used instead.
+ *
+ * Windows not starting at the line start are highlighted as if no block was open before them and the state after
+ * the line is kept as it was, so edit inside the line never re-lexes lines after it. Pasting more than a window,
+ * inserting such a line or changing the state before it is left to hi_relex(), as there are no styles to keep.
+ */
+static void hi_lex_long_line(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int start, unsigned int state, int pos, int len) {
+	int end = buf->line_end(start), next = (end < buf->length()) ? end + 1 : end;
+	int ws[2], we[2], n = 0, i, p, vs, ve;
+
+	/* the edit */
+	if(pos + len >= start && pos <= end) {
+		ws[n] = pos - LONG_LINE_WINDOW;
+		we[n] = pos + len + LONG_LINE_WINDOW;
+		n++;
+	}
+
+	/* visible part if display wraps lines, cursor otherwise */
+	priv->visible_chars(&vs, &ve);
+	ws[n] = (vs > start) ? vs : start;
+	we[n] = (ve < end) ? ve : end;
+
+	if(we[n] - ws[n] > 2 * LONG_LINE_WINDOW) {
+		p = priv->self->insert_position();
+		ws[n] = p - LONG_LINE_WINDOW;
+		we[n] = (p >= start && p <= end) ? p + LONG_LINE_WINDOW : ws[n];
+	}
+
+	if(ws[n] < we[n]) n++;
+
+	/* overlapping windows are done at once */
+	if(n == 2 && ws[1] <= we[0] && ws[0] <= we[1]) {
+		ws[0] = (ws[1] < ws[0]) ? ws[1] : ws[0];
+		we[0] = (we[1] > we[0]) ? we[1] : we[0];
+		n = 1;
+	}
+
+	for(i = 0; i < n; i++) {
+		ws[i] = (ws[i] > start) ? ws[i] : start;
+		we[i] = (we[i] < end) ? we[i] : next;
+
+		/* start after whitespace if there is some close, so the window doesn't start inside a word */
+		for(p = ws[i]; p > start && ws[i] - p < 64 && !strchr(" \t", *buf->address(p - 1)); p--)
+			;
+		if(ws[i] - p < 64) ws[i] = p;
+
+		if(ws[i] < we[i])
+			hi_lex_window(priv, buf, ws[i], we[i], (ws[i] == start) ? state : 0);
+	}
+}
+
+/*
+ * Re-lex lines starting from 'line' with given incoming state, until we reach line 'last' and line state after it
+ * matches the one we had before the edit. Lines are parsed in growing chunks, so change that runs to the end of
+ * the buffer (e.g. opened block comment) doesn't call hi_parse() for every line. Every chunk includes newline of its
+ * last line, as blocks paint it too. 'len' bytes at 'pos' are the edit, for lines hi_lex_long_line() does.
+ *
+ * Lines after 'lexed_line' are left to idle callback; with idle highlighting enabled, the same is done with the rest
+ * of the change once more than IDLE_CHUNK_LINES lines after the edit were re-lexed. Returns the first line that
+ * wasn't re-lexed.
+ */
+static int hi_relex(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf, int line, int start, int last, unsigned int state,
+					int pos, int len)
+{
+	unsigned int *eol;
+	int  end, nlines, chunk = 1, first = line;
+
+	while(line < priv->lexed_line) {
+		if(hi_background(priv) && line - last > IDLE_CHUNK_LINES) {
+			priv->lexed_line = line;
+			priv->lexed_pos  = start;
+			break;
+		}
+
+		/* always cover lines touched by the edit in the first pass */
+		nlines = (line + chunk <= last) ? last - line + 1 : chunk;
+		if(line + nlines > priv->lexed_line)
+			nlines = priv->lexed_line - line;
+
+		/*
+		 * Edit only inside too long line keeps state after it, so nothing after it is re-lexed; see hi_lex_long_line().
+		 * Lines before the edited one are not changed, so its incoming state is the same as before.
+		 */
+		nlines = hi_short_lines(priv, buf, start, nlines);
+		if(!nlines && line == first && line == last && len <= LONG_LINE_WINDOW) {
+			hi_lex_long_line(priv, buf, start, state, pos, len);
+			return line + 1;
+		}
+
+		/*
+		 * Too long line was inserted (lines before 'last' have new states), more than a window was pasted into it or
+		 * state after the previous line changed (e.g. edit before it opened a block), so it has neither styles nor
+		 * state to keep. It is highlighted whole once, like loaded text: by idle callback or background thread if there
+		 * is one, otherwise right here, and lines after it are re-lexed until the state converges again.
+		 */
+		if(!nlines) {
+			if(hi_background(priv)) {
+				priv->lexed_line = line;
+				priv->lexed_pos  = start;
+				break;
+			}
+
+			nlines = 1;
+		}
+
+		/* one more for the state after the trailing newline */
+		eol = hi_reserve(priv->eol_tmp, priv->eol_tmp_size, nlines + 1);
+		end = hi_lex_lines(priv, buf, start, nlines, state, eol);
+
+		/* stop at the first line after the edit where state converged */
+		int i, done = 0;
+		for(i = 0; i < nlines; i++) {
+			if(line + i >= last && priv->line_state[line + i] == eol[i]) {
+				done = 1;
+				break;
+			}
+		}
+
+		memcpy(priv->line_state + line, eol, sizeof(unsigned int) * (done ? i : nlines));
+		if(done) return line + i;
+
+		state  = eol[nlines - 1];
+		line  += nlines;
+		start  = end;
+		chunk *= 2;
+	}
+
+	return line;
 }
 
 /* Mostly stolen from FLTK editor.cxx example. Obviously (c)-ed by editor.cxx author... */
@@ -1134,67 +4574,147 @@ static void hi_update(int pos, int ninserted, int ndeleted,
 	Fl_Text_Buffer *buf         = priv->self->buffer();
 
 	if(ninserted == 0 && ndeleted == 0) {
-		priv->stylebuf->unselect();
+		if(priv->stylebuf) priv->stylebuf->unselect();
 		return;
 	}
 
-	char *style, *text, last;
-	int  start, end;
+	int line, nl_inserted, nl_deleted = 0;
+	priv->redrawn_lines = 0;
 
-	if(ninserted > 0) {
-		/* insert characters in style buffer */
-		style = new char[ninserted + 1];
-		memset(style, 'A', ninserted);
-		style[ninserted] = '\0';
+	/* inserted text starts unhighlighted, in both style stores */
+	priv->styles.fill(pos, ndeleted, 'A', ninserted);
+	priv->stale.shift(pos, ndeleted, ninserted);
 
-		priv->stylebuf->replace(pos, pos + ndeleted, style);
-		delete[] style;
-	} else {
-		/* just delete characters in style buffer */
-		priv->stylebuf->remove(pos, pos + ndeleted);
+	if(priv->stylebuf) {
+		if(ndeleted > 0)
+			priv->stylebuf->remove_styles(pos, pos + ndeleted);
+		if(ninserted > 0)
+			priv->stylebuf->insert_default(pos, ninserted);
+
+		/* select the area that was just updated */
+		priv->stylebuf->select(pos, pos + ninserted - ndeleted);
+	}
+
+	/* count changed lines and move line hint if edit was before it */
+	nl_inserted = buf->count_lines(pos, pos + ninserted);
+	for(int i = 0; deletedtext && i < ndeleted; i++) {
+		if(deletedtext[i] == '\n')
+			nl_deleted++;
+	}
+
+	if(pos < priv->line_hint_pos) {
+		if(pos + ndeleted < priv->line_hint_pos) {
+			priv->line_hint_pos  += ninserted - ndeleted;
+			priv->line_hint_line += nl_inserted - nl_deleted;
+		} else {
+			priv->line_hint_pos = priv->line_hint_line = 0;
+		}
+	}
+
+	line = hi_line_of(priv, buf, pos);
+
+	/* edit touching lines which are not highlighted yet is left to idle callback */
+	if(line + nl_deleted < priv->lexed_line) {
+		priv->lexed_line += nl_inserted - nl_deleted;
+		priv->lexed_pos  += ninserted - ndeleted;
+	} else if(line < priv->lexed_line) {
+		priv->lexed_line = line;
+		priv->lexed_pos  = buf->line_start(pos);
 	}
 
-	/* select the area that was just updated */
-	priv->stylebuf->select(pos, pos + ninserted - ndeleted);
+	priv->shift_line_states(line, nl_deleted, nl_inserted);
+	priv->spec_line = -1;
+	priv->revision++;
+
+	if(!priv->ctable) return;
+
+	/* large file; inside batch, visible lines are highlighted by end_batch() */
+	if(priv->tier != HI_TIER_FULL) {
+		if(priv->tier != HI_TIER_PLAIN && !priv->batch)
+			hi_lex_viewport(priv, buf);
+		return;
+	}
+
+	/* large insert (e.g. loaded file) is highlighted in idle time */
+	if(hi_background(priv) && nl_inserted > IDLE_CHUNK_LINES && line < priv->lexed_line) {
+		priv->lexed_line = line;
+		priv->lexed_pos  = buf->line_start(pos);
+	}
+
+	/*
+	 * Inside batch, only remember what to re-lex; deletion still changes the line it was done in. Ranges start where
+	 * the edit was, not at the line start, so hi_lex_long_line() knows where the edit of a too long line is.
+	 */
+	if(priv->batch) {
+		int end = pos + ninserted;
+
+		priv->dirty.shift(pos, ndeleted, ninserted);
+		priv->dirty.add(pos, (end > pos) ? end : pos + 1);
+		return;
+	}
 
 	/*
-	 * Re-parse the changed region; we do this by parsing from the
-	 * beginning of the previous line of the changed region to the end of
-	 * the line of the changed region...  Then we check the last
-	 * style character and keep updating if we have a multi-line
-	 * comment character...
+	 * Re-parse the changed region; we do this by parsing from the beginning of the line of the changed region to the end
+	 * of the last changed line. If lexer state at the end of it changed (e.g. block comment was opened or closed), we
+	 * continue with following lines until we find the line where state is the same as before.
 	 */
-	start = buf->line_start(pos);
-	end   = buf->line_end(pos + ninserted);
-	text  = buf->text_range(start, end);
-	style = priv->stylebuf->text_range(start, end);
-	last  = (start == end) ? 0 : style[end - start - 1];
+	hi_relex(priv, buf, line, buf->line_start(pos), line + nl_inserted,
+			 line > 0 ? priv->line_state[line - 1] : 0, pos, ninserted);
 
-	hi_parse(priv->ctable, text, style, end - start);
+	if(priv->lexed_line < priv->line_state_last)
+		hi_lex_visible(priv, buf);
 
-	priv->stylebuf->replace(start, end, style);
-	priv->self->redisplay_range(start, end);
+	/* also tells background thread its job is outdated */
+	hi_schedule(priv);
+	priv->trim_scratch();
+}
 
-	if(start == end || last != style[end - start - 1]) {
-		/*
-		 * Either the user deleted some text, or the last character on the line changed
-		 * styles, so reparse the remainder of the buffer...
-		 */
-		free(text);
-		free(style);
+/*
+ * Re-lex text changed inside batch. Ranges are sorted, so when re-lexing one of them had to continue over the
+ * next ones, those are skipped.
+ */
+static void hi_commit_batch(Fl_Highlight_Editor_P *priv, Fl_Text_Buffer *buf) {
+	HiRanges *dirty = &priv->dirty;
+	int len = buf->length(), relexed = 0, line, last, start, end;
+
+	priv->redrawn_lines = 0;
 
-		end   = buf->length();
-		text  = buf->text_range(start, end);
-		style = priv->stylebuf->text_range(start, end);
+	for(int i = 0; i < dirty->n; i++) {
+		start = (dirty->start[i] < len) ? dirty->start[i] : len;
+		end   = (dirty->end[i] < len) ? dirty->end[i] : len;
 
-		hi_parse(priv->ctable, text, style, end - start);
-		priv->stylebuf->replace(start, end, style);
-		priv->self->redisplay_range(start, end);
+		line = hi_line_of(priv, buf, start);
+		last = hi_line_of(priv, buf, end);
+		if(last < relexed) continue;
+
+		relexed = hi_relex(priv, buf, line, buf->line_start(start), last,
+						   line > 0 ? priv->line_state[line - 1] : 0, start, end - start);
 	}
 
+	dirty->clear();
+
+	if(priv->lexed_line < priv->line_state_last)
+		hi_lex_visible(priv, buf);
+
+	hi_schedule(priv);
+	priv->trim_scratch();
+}
+
+void Fl_Highlight_Editor::begin_batch(void) {
+	if(priv) priv->batch++;
+}
+
+void Fl_Highlight_Editor::end_batch(void) {
+	if(!priv || priv->batch == 0 || --priv->batch > 0) return;
+
+	if(buffer() && priv->ctable && priv->tier != HI_TIER_FULL) {
+		if(priv->tier != HI_TIER_PLAIN)
+			hi_lex_viewport(priv, buffer());
+	} else if(buffer() && priv->ctable && !priv->dirty.empty()) {
+		hi_commit_batch(priv, buffer());
+	}
 
-	free(text);
-	free(style);
+	priv->dirty.clear();
 }
 
 void Fl_Highlight_Editor::buffer(Fl_Text_Buffer *buf) {
@@ -1205,6 +4725,14 @@ void Fl_Highlight_Editor::buffer(Fl_Text_Buffer *buf) {
 	Fl_Text_Display::buffer(buf);
 
 	if(priv) {
+		/* ranges of the old buffer */
+		priv->dirty.clear();
+
+		/* rules that were too slow on the old text */
+		PARSE_LOCK(priv);
+		priv->enable_rules();
+		PARSE_UNLOCK(priv);
+
 		/* new buffer requires another update callback */
 		priv->update_cb_added = false;
 		repaint(Fl_Highlight_Editor::REPAINT_ALL);
@@ -1216,14 +4744,26 @@ void Fl_Highlight_Editor::repaint(int what, const char *mode) {
 
 	if(what & Fl_Highlight_Editor::REPAINT_CONTEXT) {
 		puts("Repainting context...");
-		priv->clear_contexts();
+		/* background thread could be using them */
+		PARSE_LOCK(priv);
+		priv->stash_contexts();
 		priv = load_context_table(priv);
+		priv->enable_rules();
+		PARSE_UNLOCK(priv);
+
+		/* the mode was just loaded from its file; save compiled contexts for the next start */
+		priv->save_mode_image();
 	}
 
 	if(what & Fl_Highlight_Editor::REPAINT_STYLE) {
 		puts("Repainting styles...");
+		/* faces are assigned to contexts too */
+		PARSE_LOCK(priv);
 		priv->clear_styles();
 		priv = load_face_table(priv);
+		/* faces can get different style characters */
+		priv->line_cache.clear();
+		PARSE_UNLOCK(priv);
 	}
 
 	/*
@@ -1233,8 +4773,8 @@ void Fl_Highlight_Editor::repaint(int what, const char *mode) {
 	 */
 	hi_init(priv, buffer());
 
-	/* ASSERT(priv->stylebuf != NULL); */
-	if(priv->stylebuf == NULL) {
+	/* plain tier draws text without styles; see hi_display_styles() */
+	if(priv->stylebuf == NULL && priv->tier != HI_TIER_PLAIN) {
 		puts("No stylebuf!! Check scheme code or something went wrong...");
 		return;
 	}
@@ -1256,9 +4796,23 @@ int Fl_Highlight_Editor::loadfile(const char *file, int buflen) {
 
 	int ret;
 
-	if(priv) scheme_run_hook(priv->scm, "*editor-before-loadfile-hook*", scheme_argsf(priv->scm, "s", file));
+	/* mode loaded by the hook and the file itself are highlighted once, after the file is loaded */
+	if(priv) {
+		priv->loading = true;
+		priv->tier = HI_TIER_PLAIN;
+		scheme_run_hook(priv->scm, "*editor-before-loadfile-hook*", scheme_argsf(priv->scm, "s", file));
+
+		/* no styles are kept for text being loaded, if hook didn't already load a mode */
+		if(priv->styletable_size) hi_display_styles(priv, buffer());
+	}
 
 	ret = buffer()->loadfile(file, buflen);
+
+	if(priv) {
+		priv->loading = false;
+		repaint(0);
+	}
+
 	if(ret != 0) return ret;
 
 	if(priv) scheme_run_hook(priv->scm, "*editor-after-loadfile-hook*", scheme_argsf(priv->scm, "s", file));
@@ -1285,6 +4839,15 @@ int Fl_Highlight_Editor::handle(int e) {
 	return ret;
 }
 
+void Fl_Highlight_Editor::draw(void) {
+	/* large files are highlighted as they are scrolled to */
+	if(priv && buffer() && priv->ctable && (priv->tier == HI_TIER_VIEWPORT || priv->tier == HI_TIER_NO_REGEX))
+		hi_lex_viewport(priv, buffer());
+
+	if(priv) priv->sync_visible_styles();
+	Fl_Text_Editor::draw();
+}
+
 int Fl_Highlight_Editor::tab_press(int c, Fl_Text_Editor *e) {
 	Fl_Highlight_Editor *ed = (Fl_Highlight_Editor*)e;
 	if(!ed->expand_tabs()) return 0;
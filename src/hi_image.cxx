@@ -0,0 +1,218 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hi_image.h"
+
+static const char image_magic[8] = { 'H', 'I', 'M', 'O', 'D', 'E', '\0', '\0' };
+
+/* byte order and type sizes of the machine that wrote the image */
+static int image_layout(void) {
+	union { int i; unsigned char c[sizeof(int)]; } order;
+	order.i = 1;
+
+	return (order.c[0] << 24) | ((int)sizeof(int) << 16) | ((int)sizeof(long long) << 8) | (int)sizeof(unsigned int);
+}
+
+/* FNV-1a of image contents, stored after them, so damaged image is rejected before anything is read from it */
+static unsigned int image_checksum(const char *p, long n) {
+	unsigned int h = 2166136261U;
+
+	for(long i = 0; i < n; i++) {
+		h ^= (unsigned char)p[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+HiImageWriter::HiImageWriter() {
+	data = NULL;
+	len = size = 0;
+}
+
+HiImageWriter::~HiImageWriter() {
+	free(data);
+}
+
+void HiImageWriter::put(const void *p, long n) {
+	if(len + n > size) {
+		size = size ? size * 2 : 4096;
+		while(size < len + n)
+			size *= 2;
+
+		data = (char*)realloc(data, size);
+	}
+
+	memcpy(data + len, p, n);
+	len += n;
+}
+
+void HiImageWriter::put_int(int v) {
+	put(&v, sizeof(v));
+}
+
+void HiImageWriter::put_long(long long v) {
+	put(&v, sizeof(v));
+}
+
+void HiImageWriter::put_str(const char *s) {
+	if(!s) {
+		put_int(-1);
+		return;
+	}
+
+	int n = strlen(s);
+	put_int(n);
+	put(s, n + 1);
+}
+
+void HiImageWriter::header(void) {
+	put(image_magic, sizeof(image_magic));
+	put_int(HI_IMAGE_VERSION);
+	put_int(image_layout());
+}
+
+bool HiImageWriter::save(const char *path) const {
+	int   n   = strlen(path) + 32;
+	char *tmp = new char[n];
+	snprintf(tmp, n, "%s.%d", path, (int)getpid());
+
+	FILE *fd = fopen(tmp, "wb");
+	bool  ok = false;
+
+	if(fd) {
+		unsigned int sum = image_checksum(data, len);
+
+		ok = fwrite(data, 1, len, fd) == (size_t)len && fwrite(&sum, sizeof(sum), 1, fd) == 1;
+		ok = (fclose(fd) == 0) && ok;
+		ok = ok && rename(tmp, path) == 0;
+
+		if(!ok) unlink(tmp);
+	}
+
+	delete [] tmp;
+	return ok;
+}
+
+HiImageReader::HiImageReader() {
+	map = NULL;
+	map_size = 0;
+	p = end = NULL;
+	error = true;
+}
+
+HiImageReader::~HiImageReader() {
+	if(map) munmap(map, map_size);
+}
+
+bool HiImageReader::open(const char *path) {
+	int fd = ::open(path, O_RDONLY);
+	if(fd == -1) return false;
+
+	struct stat st;
+	if(fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(unsigned int)) {
+		void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(m != MAP_FAILED) {
+			unsigned int sum;
+
+			map      = m;
+			map_size = st.st_size;
+			p        = (const char*)m;
+			end      = p + map_size - sizeof(sum);
+
+			memcpy(&sum, end, sizeof(sum));
+			error = (sum != image_checksum(p, end - p));
+		}
+	}
+
+	close(fd);
+	return !error;
+}
+
+bool HiImageReader::header(void) {
+	const void *magic = get(sizeof(image_magic));
+
+	if(!magic || memcmp(magic, image_magic, sizeof(image_magic)) != 0) {
+		error = true;
+		return false;
+	}
+
+	if(get_int() != HI_IMAGE_VERSION || get_int() != image_layout())
+		error = true;
+
+	return !error;
+}
+
+const void *HiImageReader::get(long n) {
+	if(error || n < 0 || n > end - p) {
+		error = true;
+		return NULL;
+	}
+
+	const void *ret = p;
+	p += n;
+	return ret;
+}
+
+bool HiImageReader::get(void *out, long n) {
+	const void *v = get(n);
+
+	if(!v) {
+		memset(out, 0, n > 0 ? n : 0);
+		return false;
+	}
+
+	memcpy(out, v, n);
+	return true;
+}
+
+int HiImageReader::get_int(void) {
+	int v;
+	get(&v, sizeof(v));
+	return v;
+}
+
+long long HiImageReader::get_long(void) {
+	long long v;
+	get(&v, sizeof(v));
+	return v;
+}
+
+const char *HiImageReader::get_str(void) {
+	int n = get_int();
+	if(n < 0) {
+		if(n != -1) error = true;
+		return NULL;
+	}
+
+	const char *s = (const char*)get((long)n + 1);
+	if(s && s[n] != '\0') {
+		error = true;
+		return NULL;
+	}
+
+	return s;
+}
@@ -0,0 +1,79 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_IMAGE_H
+#define HI_IMAGE_H
+
+/*
+ * Binary image of compiled matchers, written once and mapped back on the next start, so they are not compiled again
+ * (see mode images in Fl_Highlight_Editor.cxx). Values are stored in host byte order and size; image starts with a
+ * header, so image made by another version or on another kind of machine is rejected instead of misread, and ends
+ * with checksum of everything before it.
+ */
+
+/* increase when the layout of anything written into image changes */
+#define HI_IMAGE_VERSION 3
+
+struct HiImageWriter {
+	char *data;
+	long  len, size;
+
+	HiImageWriter();
+	~HiImageWriter();
+
+	void put(const void *p, long n);
+	void put_int(int v);
+	void put_long(long long v);
+
+	/* length and string, with its NUL, so reader can use it in place; NULL is written as length -1 */
+	void put_str(const char *s);
+
+	void header(void);
+
+	/* write to temporary file renamed to 'path', so image is never seen half written */
+	bool save(const char *path) const;
+};
+
+/*
+ * Reads values from mapped image. Reading past the end sets 'error' and returns zeroes (or NULL), so the caller
+ * can read everything it needs and check 'error' once.
+ */
+struct HiImageReader {
+	void       *map;
+	long        map_size;
+	const char *p, *end;
+	bool        error;
+
+	HiImageReader();
+	~HiImageReader();
+
+	bool open(const char *path);
+	bool header(void);
+
+	/* pointer to the next 'n' bytes inside image */
+	const void *get(long n);
+	bool        get(void *out, long n);
+
+	int         get_int(void);
+	long long   get_long(void);
+
+	/* string inside image, valid until reader is destroyed; NULL if it was NULL */
+	const char *get_str(void);
+};
+
+#endif
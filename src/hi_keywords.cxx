@@ -0,0 +1,338 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "hi_image.h"
+#include "hi_keywords.h"
+#include "hi_literal.h"
+#include "hi_tokens.h"
+
+/* tries to place words of one bucket before perfect hash is built again with more slots */
+#define MAX_DISPLACE (1 << 16)
+
+/* FNV-1a of the word, with murmur finalizer, as FNV alone leaves low bits of short words badly mixed */
+static unsigned int word_hash(const char *s, int len, unsigned int seed) {
+	unsigned int h = HI_HASH_INIT ^ (seed * 0x9e3779b9U);
+
+	for(int i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619U;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/* number starts with a digit, or with '.' followed by one that is not part of some word ('a.5') */
+static inline bool number_at(const unsigned char *t, int i, int len, const bool *word) {
+	return IS_DIGIT(t[i]) || (t[i] == '.' && i + 1 < len && IS_DIGIT(t[i + 1]) && (i == 0 || !word[t[i - 1]]));
+}
+
+static int pow2_above(int n) {
+	int p = 1;
+	while(p < n) p *= 2;
+	return p;
+}
+
+HiKeywords::HiKeywords() {
+	nwords = words_size = 0;
+	words  = NULL;
+	wlen   = wgroup = NULL;
+	ngroups = 0;
+	numbers = identifiers = -1;
+	minlen = maxlen = 0;
+	disp   = NULL;
+	slots  = NULL;
+	nbuckets = nslots = 0;
+
+	memset(extra, 0, sizeof(extra));
+	memset(word, 0, sizeof(word));
+	memset(first, 0, sizeof(first));
+}
+
+HiKeywords::~HiKeywords() {
+	for(int i = 0; i < nwords; i++)
+		free(words[i]);
+
+	delete [] words;
+	delete [] wlen;
+	delete [] wgroup;
+	delete [] disp;
+	delete [] slots;
+}
+
+bool HiKeywords::add(const char *str, int g) {
+	if(!str || !str[0] || slots) return false;
+
+	for(const unsigned char *p = (const unsigned char*)str; *p; p++) {
+		if(*p <= ' ' || *p == 127) return false;
+	}
+
+	int id = names.find(str);
+	if(id >= 0) {
+		wgroup[id] = g;
+		return true;
+	}
+
+	/* grow if needed */
+	if(nwords >= words_size) {
+		char **owords  = words;
+		int   *owlen   = wlen, *owgroup = wgroup;
+
+		words_size = words_size ? words_size * 2 : 32;
+		words  = new char*[words_size];
+		wlen   = new int[words_size];
+		wgroup = new int[words_size];
+
+		for(int i = 0; i < nwords; i++) {
+			words[i]  = owords[i];
+			wlen[i]   = owlen[i];
+			wgroup[i] = owgroup[i];
+		}
+
+		delete [] owords;
+		delete [] owlen;
+		delete [] owgroup;
+	}
+
+	words[nwords]  = strdup(str);
+	wlen[nwords]   = strlen(str);
+	wgroup[nwords] = g;
+
+	names.intern(words[nwords]);
+	nwords++;
+	return true;
+}
+
+void HiKeywords::add_word_chars(const char *chars) {
+	for(const unsigned char *p = (const unsigned char*)chars; *p; p++) {
+		if(*p > ' ' && *p != 127) extra[*p] = true;
+	}
+}
+
+/* place every word into 'n' slots; false if some bucket can't be placed */
+bool HiKeywords::build(int n) {
+	int i, j, k, b, d, maxsize = 0;
+
+	delete [] disp;
+	delete [] slots;
+
+	nbuckets = pow2_above((nwords + 1) / 2);
+	nslots   = n;
+	disp     = new unsigned int[nbuckets];
+	slots    = new int[nslots];
+
+	for(i = 0; i < nslots; i++)
+		slots[i] = -1;
+
+	/* words not in any bucket are looked up too */
+	for(b = 0; b < nbuckets; b++)
+		disp[b] = 0;
+
+	/* words sorted by bucket */
+	int *bucket = new int[nwords + 1], *start = new int[nbuckets + 1], *order = new int[nwords + 1];
+	int *placed = new int[nwords + 1];
+
+	memset(start, 0, sizeof(int) * (nbuckets + 1));
+	for(i = 0; i < nwords; i++) {
+		bucket[i] = word_hash(words[i], wlen[i], 0) & (nbuckets - 1);
+		start[bucket[i] + 1]++;
+	}
+
+	for(b = 0; b < nbuckets; b++) {
+		if(start[b + 1] > maxsize) maxsize = start[b + 1];
+		start[b + 1] += start[b];
+	}
+
+	for(i = 0; i < nwords; i++)
+		order[start[bucket[i]]++] = i;
+
+	/* start[b] is now the end of bucket b */
+	for(b = nbuckets; b > 0; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+
+	/* the largest buckets first, while there are many free slots */
+	bool ok = true;
+
+	for(int size = maxsize; ok && size > 0; size--) {
+		for(b = 0; ok && b < nbuckets; b++) {
+			if(start[b + 1] - start[b] != size) continue;
+
+			for(d = 1; d < MAX_DISPLACE; d++) {
+				for(j = 0; j < size; j++) {
+					i = order[start[b] + j];
+					k = word_hash(words[i], wlen[i], d) & (nslots - 1);
+					if(slots[k] != -1) break;
+
+					/* words of the same bucket can't share slot either */
+					slots[k] = i;
+					placed[j] = k;
+				}
+
+				if(j == size) break;
+
+				while(j-- > 0)
+					slots[placed[j]] = -1;
+			}
+
+			disp[b] = d;
+			ok = (d < MAX_DISPLACE);
+		}
+	}
+
+	delete [] bucket;
+	delete [] start;
+	delete [] order;
+	delete [] placed;
+	return ok;
+}
+
+bool HiKeywords::compile(void) {
+	int i;
+
+	for(i = 0; i < 256; i++) {
+		word[i] = extra[i] || (i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || (i >= '0' && i <= '9') ||
+				  i == '_' || i >= 128;
+	}
+
+	minlen = nwords ? wlen[0] : 0;
+	maxlen = 0;
+
+	for(i = 0; i < nwords; i++) {
+		for(int j = 0; j < wlen[i]; j++)
+			word[(unsigned char)words[i][j]] = true;
+
+		first[(unsigned char)words[i][0]] = true;
+
+		if(wlen[i] < minlen) minlen = wlen[i];
+		if(wlen[i] > maxlen) maxlen = wlen[i];
+	}
+
+	/* at most half of the slots are used, so buckets are placed quickly */
+	for(int n = pow2_above(nwords * 2); n <= pow2_above(nwords * 64 + 1); n *= 2) {
+		if(build(n)) return true;
+	}
+
+	delete [] slots;
+	slots  = NULL;
+	nslots = 0;
+	return false;
+}
+
+int HiKeywords::find(const char *s, int len) const {
+	if(len < minlen || len > maxlen || !first[(unsigned char)*s] || !nslots)
+		return -1;
+
+	unsigned int b  = word_hash(s, len, 0) & (nbuckets - 1);
+	int          id = slots[word_hash(s, len, disp[b]) & (nslots - 1)];
+
+	return (id >= 0 && wlen[id] == len && memcmp(words[id], s, len) == 0) ? wgroup[id] : -1;
+}
+
+void HiKeywords::scan(const char *text, int len, HiLiteralHits *hits) const {
+	const unsigned char *t = (const unsigned char*)text;
+	int i = 0, start, g;
+
+	hits->reset(ngroups);
+	if(!nwords && numbers < 0 && identifiers < 0) return;
+
+	while(i < len) {
+		while(i < len && !word[t[i]] && !(numbers >= 0 && number_at(t, i, len, word)))
+			i++;
+
+		if(i >= len) break;
+
+		start = i;
+		if(numbers >= 0 && number_at(t, i, len, word)) {
+			i = hi_token_number(text, start, len, word);
+			hits->push(numbers, start);
+			hits->push(numbers, i);
+			continue;
+		}
+
+		while(i < len && word[t[i]])
+			i++;
+
+		if((g = find(text + start, i - start)) < 0 && identifiers >= 0 && !IS_DIGIT(t[start]))
+			g = identifiers;
+
+		if(g >= 0) {
+			hits->push(g, start);
+			hits->push(g, i);
+		}
+	}
+}
+
+/* perfect hash is built again on load; it takes about as long as checking that loaded one is valid would */
+void HiKeywords::save(HiImageWriter *w) const {
+	unsigned char e[256];
+
+	for(int i = 0; i < 256; i++)
+		e[i] = extra[i];
+
+	w->put_int(ngroups);
+	w->put_int(numbers);
+	w->put_int(identifiers);
+	w->put(e, sizeof(e));
+
+	w->put_int(nwords);
+	for(int i = 0; i < nwords; i++) {
+		w->put_str(words[i]);
+		w->put_int(wgroup[i]);
+	}
+}
+
+bool HiKeywords::load(HiImageReader *r) {
+	unsigned char e[256];
+	int i, n;
+
+	if(nwords || ngroups) return false;
+
+	ngroups     = r->get_int();
+	numbers     = r->get_int();
+	identifiers = r->get_int();
+	r->get(e, sizeof(e));
+	n = r->get_int();
+
+	if(r->error || ngroups < 0 || ngroups > r->end - r->p || n < 0 || numbers < -1 || numbers >= ngroups ||
+	   identifiers < -1 || identifiers >= ngroups)
+	{
+		return false;
+	}
+
+	for(i = 0; i < 256; i++)
+		extra[i] = (e[i] != 0);
+
+	for(i = 0; i < n; i++) {
+		const char *w = r->get_str();
+		int g = r->get_int();
+
+		if(!w || r->error || g < 0 || g >= ngroups || !add(w, g) || nwords != i + 1)
+			return false;
+	}
+
+	return compile();
+}
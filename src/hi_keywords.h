@@ -0,0 +1,93 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_KEYWORDS_H
+#define HI_KEYWORDS_H
+
+#include "hi_names.h"
+
+struct HiImageWriter;
+struct HiImageReader;
+struct HiLiteralHits;
+
+/*
+ * Keywords of all keyword contexts of a mode. Text is split into words (runs of word bytes: letters, digits, '_',
+ * bytes above 127, bytes keywords are made of and bytes given with add_word_chars()) and every word is looked up in
+ * perfect hash built by compile(), so finding keywords costs one pass over the text, no matter how many there are.
+ * Every keyword belongs to a group (keyword context); keyword added to more than one group is in the last one.
+ *
+ * Numbers and identifiers (words that are not keywords and don't start with a digit) are found in the same pass, if
+ * mode has contexts for them; each has own group.
+ */
+struct HiKeywords {
+	int    nwords, words_size;
+	char **words;
+	int   *wlen;
+	int   *wgroup;
+	HiNames names; /* words, so adding one doesn't compare it with all others */
+	int    ngroups;
+	int    numbers, identifiers; /* groups of numbers and identifiers; -1 if they are not searched for */
+
+	bool   extra[256]; /* word bytes given with add_word_chars() */
+	bool   word[256];  /* all word bytes; filled by compile() */
+	bool   first[256]; /* bytes keywords start with */
+	int    minlen, maxlen;
+
+	/* hash and displace: word is in slots[hash(word, disp[hash(word, 0) & (nbuckets - 1)]) & (nslots - 1)] */
+	unsigned int *disp;
+	int           nbuckets;
+	int          *slots; /* word ids, -1 for an empty slot */
+	int           nslots;
+
+	HiKeywords();
+	~HiKeywords();
+
+	/* id of a new group */
+	int  group(void) { return ngroups++; }
+
+	/* group of numbers or identifiers, which are searched for from now on */
+	int  number_group(void)     { return numbers >= 0 ? numbers : (numbers = ngroups++); }
+	int  identifier_group(void) { return identifiers >= 0 ? identifiers : (identifiers = ngroups++); }
+
+	/* add keyword to 'group'; empty string or one with spaces or control characters is ignored (returns false) */
+	bool add(const char *str, int group);
+
+	/* treat 'chars' as parts of words, besides those every keyword list has */
+	void add_word_chars(const char *chars);
+
+	/* build perfect hash; keywords can't be added after this call */
+	bool compile(void);
+
+	/* group of 'len' bytes long word at 's', or -1 if it is not a keyword */
+	int  find(const char *s, int len) const;
+
+	/*
+	 * Find every keyword, number and identifier in 'text'. Hits of each group are pairs of start and end position,
+	 * so 'hits' has 2 entries for every word found.
+	 */
+	void scan(const char *text, int len, HiLiteralHits *hits) const;
+
+	/* write keywords into image, or read them into empty table and compile it; load() fails if image is damaged */
+	void save(HiImageWriter *w) const;
+	bool load(HiImageReader *r);
+
+private:
+	bool build(int nslots);
+};
+
+#endif
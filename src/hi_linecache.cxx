@@ -0,0 +1,214 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "hi_linecache.h"
+#include "hi_names.h"
+
+struct HiLineEntry {
+	unsigned int hash, state, mode, eol;
+	int len, nruns;
+	unsigned char *data;   /* the line, followed by (style, length) pair of every run */
+	HiLineEntry *chain;    /* next line in the same table slot */
+	HiLineEntry *newer, *older;
+};
+
+/* hashed 8 bytes at a time, as lines are hashed on every hi_parse() while the cache is on */
+static unsigned int line_hash(const char *s, int len, unsigned int state, unsigned int mode) {
+	unsigned long long h = HI_HASH_INIT ^ ((unsigned long long)state << 32) ^ ((unsigned long long)mode << 7) ^ len, w;
+	int i;
+
+	for(i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, s + i, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+
+	w = 0;
+	memcpy(&w, s + i, len - i);
+	h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+	h ^= h >> 32;
+	return (unsigned int)h;
+}
+
+HiLineCache::HiLineCache() {
+	capacity = nlines = 0;
+	memory = hits = misses = 0;
+	table = NULL;
+	table_size = 0;
+	newest = oldest = NULL;
+}
+
+HiLineCache::~HiLineCache() {
+	clear();
+	delete [] table;
+}
+
+void HiLineCache::clear(void) {
+	HiLineEntry *e, *nx;
+
+	for(e = newest; e; e = nx) {
+		nx = e->older;
+		free(e);
+	}
+
+	if(table) memset(table, 0, sizeof(HiLineEntry*) * table_size);
+
+	newest = oldest = NULL;
+	nlines = 0;
+	memory = sizeof(HiLineEntry*) * table_size;
+}
+
+void HiLineCache::resize(int n) {
+	if(n < 0) n = 0;
+	if(n == capacity) return;
+
+	clear();
+	delete [] table;
+	table = NULL;
+	table_size = 0;
+
+	capacity = n;
+	hits = misses = 0;
+
+	if(capacity) {
+		for(table_size = 16; table_size < capacity; table_size *= 2)
+			;
+
+		table = new HiLineEntry*[table_size];
+		memset(table, 0, sizeof(HiLineEntry*) * table_size);
+	}
+
+	memory = sizeof(HiLineEntry*) * table_size;
+}
+
+HiLineEntry *HiLineCache::find(const char *text, int len, unsigned int hash, unsigned int state, unsigned int mode) {
+	for(HiLineEntry *e = table[hash & (table_size - 1)]; e; e = e->chain) {
+		if(e->hash == hash && e->len == len && e->state == state && e->mode == mode && memcmp(e->data, text, len) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+void HiLineCache::unlink(HiLineEntry *e) {
+	if(e->newer) e->newer->older = e->older;
+	else         newest = e->older;
+
+	if(e->older) e->older->newer = e->newer;
+	else         oldest = e->newer;
+}
+
+void HiLineCache::drop(HiLineEntry *e) {
+	HiLineEntry **p = &table[e->hash & (table_size - 1)];
+
+	while(*p != e)
+		p = &(*p)->chain;
+
+	*p = e->chain;
+	unlink(e);
+
+	memory -= sizeof(HiLineEntry) + e->len + 2 * e->nruns;
+	nlines--;
+	free(e);
+}
+
+bool HiLineCache::get(const char *text, int len, unsigned int state, unsigned int mode, char *style, unsigned int *eol) {
+	HiLineEntry *e = NULL;
+
+	if(capacity && len <= HI_LINE_CACHE_MAX_LINE)
+		e = find(text, len, line_hash(text, len, state, mode), state, mode);
+
+	if(!e) {
+		misses++;
+		return false;
+	}
+
+	const unsigned char *r = e->data + e->len;
+
+	for(int i = 0; i < e->nruns; i++, r += 2) {
+		memset(style, r[0], r[1]);
+		style += r[1];
+	}
+
+	*eol = e->eol;
+	hits++;
+
+	/* make it the most recently used one */
+	if(e != newest) {
+		unlink(e);
+		e->older = newest;
+		e->newer = NULL;
+		newest->newer = e;
+		newest = e;
+	}
+
+	return true;
+}
+
+void HiLineCache::add(const char *text, int len, unsigned int state, unsigned int mode, const char *style,
+					  unsigned int eol)
+{
+	if(!capacity || len > HI_LINE_CACHE_MAX_LINE) return;
+
+	unsigned int hash = line_hash(text, len, state, mode);
+	if(find(text, len, hash, state, mode)) return;
+
+	if(nlines >= capacity) drop(oldest);
+
+	/* runs are at most 255 bytes long, so length fits into one byte */
+	int i, n, nruns = 0;
+
+	for(i = 0; i < len; i += n, nruns++) {
+		for(n = 1; i + n < len && n < 255 && style[i + n] == style[i]; n++)
+			;
+	}
+
+	HiLineEntry *e = (HiLineEntry*)malloc(sizeof(HiLineEntry) + len + 2 * nruns);
+	unsigned char *r;
+
+	e->hash  = hash;
+	e->state = state;
+	e->mode  = mode;
+	e->eol   = eol;
+	e->len   = len;
+	e->nruns = nruns;
+	e->data  = (unsigned char*)(e + 1);
+	memcpy(e->data, text, len);
+
+	for(i = 0, r = e->data + len; i < len; i += n, r += 2) {
+		for(n = 1; i + n < len && n < 255 && style[i + n] == style[i]; n++)
+			;
+
+		r[0] = (unsigned char)style[i];
+		r[1] = (unsigned char)n;
+	}
+
+	e->chain = table[hash & (table_size - 1)];
+	table[hash & (table_size - 1)] = e;
+
+	e->newer = NULL;
+	e->older = newest;
+	if(newest) newest->newer = e;
+	else       oldest = e;
+	newest = e;
+
+	memory += sizeof(HiLineEntry) + len + 2 * nruns;
+	nlines++;
+}
@@ -0,0 +1,63 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_LINECACHE_H
+#define HI_LINECACHE_H
+
+/* longer lines are not cached; they rarely repeat and would take most of the memory */
+#define HI_LINE_CACHE_MAX_LINE 1024
+
+struct HiLineEntry;
+
+/*
+ * Styles of recently highlighted lines, keyed by line content (with its newline), lexer state before the line and
+ * mode. Styles of a line depend only on these (see hi_update()), so a line seen again with the same state can be
+ * painted from the cache instead of matching rules on it. Styles are kept run-length encoded and the line is kept
+ * too, so lines with the same hash are never mixed up. When there are 'capacity' lines, the least recently used
+ * one is dropped.
+ */
+struct HiLineCache {
+	int  capacity;   /* 0 if cache is off */
+	int  nlines;
+	long memory;     /* bytes taken by cached lines and the table */
+	long hits, misses;
+
+	HiLineEntry **table; /* chains of lines with the same hash; size is a power of two */
+	int           table_size;
+	HiLineEntry  *newest, *oldest;
+
+	HiLineCache();
+	~HiLineCache();
+
+	/* drop every line; with different capacity, the table is allocated again and counters are reset */
+	void clear(void);
+	void resize(int capacity);
+
+	/* paint 'len' bytes long line with cached styles and set 'eol' to the state after it; counts hit or miss */
+	bool get(const char *text, int len, unsigned int state, unsigned int mode, char *style, unsigned int *eol);
+
+	/* remember styles of the line; 'eol' is the state after it */
+	void add(const char *text, int len, unsigned int state, unsigned int mode, const char *style, unsigned int eol);
+
+private:
+	HiLineEntry *find(const char *text, int len, unsigned int hash, unsigned int state, unsigned int mode);
+	void unlink(HiLineEntry *e);
+	void drop(HiLineEntry *e);
+};
+
+#endif
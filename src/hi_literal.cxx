@@ -0,0 +1,353 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "hi_image.h"
+#include "hi_literal.h"
+
+HiLiteralHits::HiLiteralHits() {
+	pos   = NULL;
+	count = size = NULL;
+	npatterns = 0;
+}
+
+HiLiteralHits::~HiLiteralHits() {
+	for(int i = 0; i < npatterns; i++)
+		delete [] pos[i];
+
+	delete [] pos;
+	delete [] count;
+	delete [] size;
+}
+
+void HiLiteralHits::reset(int n) {
+	/* grow if needed; already allocated position arrays are kept */
+	if(n > npatterns) {
+		int **opos = pos, *ocount = count, *osize = size;
+
+		pos   = new int*[n];
+		count = new int[n];
+		size  = new int[n];
+
+		for(int i = 0; i < n; i++) {
+			pos[i]  = (i < npatterns) ? opos[i] : NULL;
+			size[i] = (i < npatterns) ? osize[i] : 0;
+		}
+
+		delete [] opos;
+		delete [] ocount;
+		delete [] osize;
+		npatterns = n;
+	}
+
+	for(int i = 0; i < npatterns; i++)
+		count[i] = 0;
+}
+
+void HiLiteralHits::push(int pattern, int start) {
+	if(count[pattern] >= size[pattern]) {
+		int *old = pos[pattern];
+
+		size[pattern] = size[pattern] ? size[pattern] * 2 : 16;
+		pos[pattern]  = new int[size[pattern]];
+
+		if(old) {
+			memcpy(pos[pattern], old, sizeof(int) * count[pattern]);
+			delete [] old;
+		}
+	}
+
+	pos[pattern][count[pattern]++] = start;
+}
+
+HiLiteral::HiLiteral() {
+	npatterns = patterns_size = 0;
+	patterns  = NULL;
+	plen      = NULL;
+	nclasses  = 0;
+	nstates   = 0;
+	next = own = dict = NULL;
+	memset(classes, 0, sizeof(classes));
+}
+
+HiLiteral::~HiLiteral() {
+	for(int i = 0; i < npatterns; i++)
+		free(patterns[i]);
+
+	delete [] patterns;
+	delete [] plen;
+	delete [] next;
+	delete [] own;
+	delete [] dict;
+}
+
+int HiLiteral::add(const char *str) {
+	if(!str || !str[0] || next) return -1;
+
+	int id = names.find(str);
+	if(id >= 0) return id;
+
+	/* grow if needed */
+	if(npatterns >= patterns_size) {
+		char **opatterns = patterns;
+		int   *oplen     = plen;
+
+		patterns_size = patterns_size ? patterns_size * 2 : 8;
+		patterns = new char*[patterns_size];
+		plen     = new int[patterns_size];
+
+		for(int i = 0; i < npatterns; i++) {
+			patterns[i] = opatterns[i];
+			plen[i]     = oplen[i];
+		}
+
+		delete [] opatterns;
+		delete [] oplen;
+	}
+
+	patterns[npatterns] = strdup(str);
+	plen[npatterns] = strlen(str);
+	names.intern(patterns[npatterns]);
+	return npatterns++;
+}
+
+bool HiLiteral::compile(void) {
+	int i, j, c, s, max_states;
+
+	/* every byte found in patterns gets own class */
+	memset(classes, 0, sizeof(classes));
+	nclasses = 1;
+
+	max_states = 1;
+	for(i = 0; i < npatterns; i++) {
+		max_states += plen[i];
+
+		for(j = 0; j < plen[i]; j++) {
+			c = (unsigned char)patterns[i][j];
+			if(!classes[c]) classes[c] = nclasses++;
+		}
+	}
+
+	next = new int[max_states * nclasses];
+	own  = new int[max_states];
+	dict = new int[max_states];
+
+	for(i = 0; i < max_states * nclasses; i++)
+		next[i] = -1;
+
+	own[0] = dict[0] = -1;
+	nstates = 1;
+
+	/* build trie */
+	for(i = 0; i < npatterns; i++) {
+		s = 0;
+		for(j = 0; j < plen[i]; j++) {
+			int *t = &next[s * nclasses + classes[(unsigned char)patterns[i][j]]];
+
+			if(*t == -1) {
+				*t = nstates;
+				own[nstates] = dict[nstates] = -1;
+				nstates++;
+			}
+
+			s = *t;
+		}
+
+		own[s] = i;
+	}
+
+	/*
+	 * Breadth first walk computing failure links and turning trie into full transition table, so missing
+	 * transitions go directly where failure links would lead.
+	 */
+	int *fail  = new int[nstates];
+	int *queue = new int[nstates];
+	int qhead = 0, qtail = 0;
+
+	fail[0] = 0;
+	for(c = 0; c < nclasses; c++) {
+		int *t = &next[c];
+
+		if(*t == -1) {
+			*t = 0;
+		} else {
+			fail[*t] = 0;
+			queue[qtail++] = *t;
+		}
+	}
+
+	while(qhead < qtail) {
+		s = queue[qhead++];
+
+		for(c = 0; c < nclasses; c++) {
+			int *t = &next[s * nclasses + c];
+
+			if(*t == -1) {
+				*t = next[fail[s] * nclasses + c];
+			} else {
+				fail[*t] = next[fail[s] * nclasses + c];
+				queue[qtail++] = *t;
+			}
+		}
+
+		/* fail[s] was visited before 's', so its dictionary link is already known */
+		dict[s] = (own[fail[s]] != -1) ? fail[s] : dict[fail[s]];
+	}
+
+	delete [] fail;
+	delete [] queue;
+
+	find_first();
+	return true;
+}
+
+void HiLiteral::find_first(void) {
+	first.clear();
+
+	for(int c = 0; c < 256; c++) {
+		/* the start state matching something would make every byte interesting */
+		if(next[classes[c]] != 0 || own[0] != -1 || dict[0] != -1)
+			first.add(c);
+	}
+}
+
+void HiLiteral::scan(const char *text, int len, HiLiteralHits *hits) const {
+	hits->reset(npatterns);
+	if(!next) return;
+
+	int s = 0, t;
+	for(int i = 0; i < len; i++) {
+		/* in the start state, bytes that don't start any pattern keep it there */
+		if(s == 0) {
+			i += hi_scan_bytes(&first, text + i, len - i);
+			if(i == len) break;
+		}
+
+		s = next[s * nclasses + classes[(unsigned char)text[i]]];
+
+		for(t = (own[s] != -1) ? s : dict[s]; t != -1; t = dict[t])
+			hits->push(own[t], i - plen[own[t]] + 1);
+	}
+}
+
+void HiLiteral::save(HiImageWriter *w) const {
+	w->put_int(npatterns);
+	for(int i = 0; i < npatterns; i++)
+		w->put_str(patterns[i]);
+
+	w->put_int(nclasses);
+	w->put(classes, sizeof(classes));
+
+	w->put_int(nstates);
+	w->put(next, sizeof(int) * nstates * nclasses);
+	w->put(own, sizeof(int) * nstates);
+	w->put(dict, sizeof(int) * nstates);
+}
+
+bool HiLiteral::load(HiImageReader *r) {
+	int i, n = r->get_int();
+	if(r->error || n < 0 || npatterns) return false;
+
+	for(i = 0; i < n; i++) {
+		const char *p = r->get_str();
+		if(!p || add(p) != i) return false;
+	}
+
+	nclasses = r->get_int();
+	r->get(classes, sizeof(classes));
+	nstates  = r->get_int();
+
+	if(r->error || nclasses < 1 || nclasses > 256 || nstates < 1 ||
+	   (long)nstates * nclasses > 256L * 1024 * 1024)
+	{
+		nstates = 0;
+		return false;
+	}
+
+	next = new int[nstates * nclasses];
+	own  = new int[nstates];
+	dict = new int[nstates];
+
+	if(!r->get(next, sizeof(int) * nstates * nclasses) || !r->get(own, sizeof(int) * nstates) ||
+	   !r->get(dict, sizeof(int) * nstates))
+		return false;
+
+	/* scan() follows these without checking */
+	for(i = 0; i < 256; i++) {
+		if(classes[i] >= nclasses) return false;
+	}
+
+	for(i = 0; i < nstates * nclasses; i++) {
+		if(next[i] < 0 || next[i] >= nstates) return false;
+	}
+
+	for(i = 0; i < nstates; i++) {
+		if(own[i] < -1 || own[i] >= npatterns || dict[i] < -1 || dict[i] >= nstates) return false;
+	}
+
+	if(!check_links()) return false;
+
+	find_first();
+	return true;
+}
+
+/*
+ * Check that dictionary links of loaded automaton lead to states with patterns that are strictly shallower, so scan()
+ * always gets to the end of the chain. Depth of the state is its distance from the start state, which in valid
+ * automaton is the length of the text it stands for; it is also checked against the length of state's own pattern.
+ */
+bool HiLiteral::check_links(void) {
+	int *depth = new int[nstates], *queue = new int[nstates];
+	int qhead = 0, qtail = 0, s, t, c;
+	bool ok = true;
+
+	for(s = 0; s < nstates; s++)
+		depth[s] = -1;
+
+	depth[0] = 0;
+	queue[qtail++] = 0;
+
+	while(qhead < qtail) {
+		s = queue[qhead++];
+
+		for(c = 0; c < nclasses; c++) {
+			t = next[s * nclasses + c];
+			if(depth[t] == -1) {
+				depth[t] = depth[s] + 1;
+				queue[qtail++] = t;
+			}
+		}
+	}
+
+	for(s = 0; s < nstates && ok; s++) {
+		/* unreachable states are never entered by scan(), but links must not lead to them */
+		if(depth[s] == -1) continue;
+
+		if(own[s] != -1 && plen[own[s]] != depth[s])
+			ok = false;
+
+		t = dict[s];
+		if(t != -1 && (depth[t] == -1 || depth[t] >= depth[s] || own[t] == -1))
+			ok = false;
+	}
+
+	delete [] depth;
+	delete [] queue;
+	return ok;
+}
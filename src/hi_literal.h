@@ -0,0 +1,85 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_LITERAL_H
+#define HI_LITERAL_H
+
+#include "hi_names.h"
+#include "hi_scan.h"
+
+struct HiImageWriter;
+struct HiImageReader;
+
+/*
+ * Start positions of every literal found by HiLiteral::scan(), grouped by pattern and sorted. Arrays are only
+ * grown, so the same object can be reused between scans without allocating.
+ */
+struct HiLiteralHits {
+	int **pos;
+	int  *count;
+	int  *size;
+	int   npatterns;
+
+	HiLiteralHits();
+	~HiLiteralHits();
+
+	void reset(int npatterns);
+	void push(int pattern, int start);
+};
+
+/*
+ * Aho-Corasick automaton for finding all literal tokens of a mode in one pass over the text. Bytes are mapped to
+ * classes (bytes not used in any pattern share class 0), so transition table is nstates * nclasses large.
+ */
+struct HiLiteral {
+	int   npatterns, patterns_size;
+	char **patterns;
+	int   *plen;
+	HiNames names; /* patterns, so adding one doesn't compare it with all others */
+
+	unsigned char classes[256];
+	int   nclasses;
+
+	int   nstates;
+	int  *next; /* full transition table, so scan never follows failure links */
+	int  *own;  /* pattern ending in this state or -1 */
+	int  *dict; /* closest state on failure chain with own pattern or -1 */
+
+	HiByteSet first; /* bytes patterns start with; scan() skips everything else while no pattern is started */
+
+	HiLiteral();
+	~HiLiteral();
+
+	/* add pattern and return its id; the same string added twice gets the same id, empty string is ignored (-1) */
+	int  add(const char *str);
+
+	/* build automaton; patterns can't be added after this call */
+	bool compile(void);
+
+	void scan(const char *text, int len, HiLiteralHits *hits) const;
+
+	/* write compiled automaton into image, or read it into empty matcher; load() fails if image is damaged */
+	void save(HiImageWriter *w) const;
+	bool load(HiImageReader *r);
+
+private:
+	void find_first(void);
+	bool check_links(void);
+};
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "hi_names.h"
+
+unsigned int hi_hash_string(unsigned int h, const char *s) {
+	do {
+		h ^= (unsigned char)*s;
+		h *= 16777619U;
+	} while(*s++);
+
+	return h;
+}
+
+static unsigned int hash_name(const char *s) {
+	return hi_hash_string(HI_HASH_INIT, s);
+}
+
+HiNames::HiNames() {
+	names  = NULL;
+	hashes = NULL;
+	nnames = names_size = 0;
+	table  = NULL;
+	table_size = 0;
+}
+
+HiNames::~HiNames() {
+	delete [] names;
+	delete [] hashes;
+	delete [] table;
+}
+
+void HiNames::clear(void) {
+	nnames = 0;
+	for(int i = 0; i < table_size; i++)
+		table[i] = -1;
+}
+
+void HiNames::swap(HiNames &o) {
+	const char  **nn = names;  names  = o.names;  o.names  = nn;
+	unsigned int *nh = hashes; hashes = o.hashes; o.hashes = nh;
+	int          *nt = table;  table  = o.table;  o.table  = nt;
+	int i;
+
+	i = nnames;     nnames     = o.nnames;     o.nnames     = i;
+	i = names_size; names_size = o.names_size; o.names_size = i;
+	i = table_size; table_size = o.table_size; o.table_size = i;
+}
+
+int HiNames::find(const char *name) const {
+	if(!table_size) return -1;
+
+	unsigned int h = hash_name(name), mask = table_size - 1;
+
+	for(unsigned int i = h & mask; table[i] >= 0; i = (i + 1) & mask) {
+		if(hashes[table[i]] == h && strcmp(names[table[i]], name) == 0)
+			return table[i];
+	}
+
+	return -1;
+}
+
+/* double both arrays and the table, keeping the table at most half full */
+void HiNames::grow(void) {
+	int sz = names_size ? names_size * 2 : 16;
+	const char **nn = new const char*[sz];
+	unsigned int *nh = new unsigned int[sz];
+
+	if(nnames) {
+		memcpy(nn, names, sizeof(const char*) * nnames);
+		memcpy(nh, hashes, sizeof(unsigned int) * nnames);
+	}
+
+	delete [] names;
+	delete [] hashes;
+	names  = nn;
+	hashes = nh;
+	names_size = sz;
+
+	delete [] table;
+	table_size = sz * 2;
+	table = new int[table_size];
+
+	for(int i = 0; i < table_size; i++)
+		table[i] = -1;
+
+	unsigned int mask = table_size - 1, j;
+	for(int i = 0; i < nnames; i++) {
+		for(j = hashes[i] & mask; table[j] >= 0; j = (j + 1) & mask)
+			;
+		table[j] = i;
+	}
+}
+
+int HiNames::intern(const char *name) {
+	int id = find(name);
+	if(id >= 0) return id;
+
+	if(nnames >= names_size)
+		grow();
+
+	unsigned int h = hash_name(name), mask = table_size - 1, i;
+	for(i = h & mask; table[i] >= 0; i = (i + 1) & mask)
+		;
+
+	names[nnames]  = name;
+	hashes[nnames] = h;
+	table[i] = nnames;
+	return nnames++;
+}
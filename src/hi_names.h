@@ -0,0 +1,58 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_NAMES_H
+#define HI_NAMES_H
+
+#define HI_HASH_INIT 2166136261U
+
+/* FNV-1a hash of 's' and its terminating NUL, continuing from 'h' (HI_HASH_INIT for the first string) */
+unsigned int hi_hash_string(unsigned int h, const char *s);
+
+/*
+ * Set of strings, where every string gets a small id (in order they were added). Strings are not copied, so they
+ * must live as long as the set does. Lookup is done with open addressing hash table, so interning n names costs O(n).
+ */
+struct HiNames {
+	const char  **names;   /* by id */
+	unsigned int *hashes;  /* hash of every name, so the table can be grown without hashing names again */
+	int           nnames, names_size;
+
+	int *table;            /* ids, -1 for an empty slot; size is a power of two */
+	int  table_size;
+
+	HiNames();
+	~HiNames();
+
+	void clear(void);
+	void swap(HiNames &o);
+
+	/* id of 'name' or -1 if it wasn't added */
+	int  find(const char *name) const;
+
+	/* id of 'name', adding it if needed */
+	int  intern(const char *name);
+
+	int  size(void) const { return nnames; }
+	const char *name(int id) const { return names[id]; }
+
+private:
+	void grow(void);
+};
+
+#endif
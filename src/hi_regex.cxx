@@ -0,0 +1,1675 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "hi_image.h"
+#include "hi_regex.h"
+
+/*
+ * Pattern is parsed into syntax tree, which is compiled twice into Thompson NFA program: once as is and once
+ * reversed. Programs are never executed directly; instead, DFA states (sets of program positions) are created
+ * lazily while scanning and cached, so every text byte costs one table lookup once the DFA warmed up.
+ *
+ * Leftmost-longest match is found with two DFAs: reversed program run backwards over the text marks every
+ * position where some match starts, and forward program run from the first marked position finds the longest
+ * match from it.
+ */
+
+#define MAX_NODES     4096  /* syntax tree nodes */
+#define MAX_INST      8192  /* program instructions, after repetitions were expanded */
+#define MAX_DFA_STATES 2048 /* DFA cache is flushed after this many states */
+#define SET_WORDS     8     /* 256 bits per character set */
+
+#define SET_HAS(set, c) ((set)[(c) >> 5] & (1U << ((c) & 31)))
+#define SET_ADD(set, c) ((set)[(c) >> 5] |= (1U << ((c) & 31)))
+
+enum {
+	OP_SET,     /* consume character from set 'arg' */
+	OP_SPLIT,   /* continue on 'x' and 'y' */
+	OP_JMP,     /* continue on 'x' */
+	OP_ASSERT,  /* zero width assertion 'arg' */
+	OP_MATCH    /* match with tag 'arg' */
+};
+
+enum {
+	AS_BOL,     /* ^ */
+	AS_EOL,     /* $ */
+	AS_BOT,     /* \` */
+	AS_EOT,     /* \' */
+	AS_WORDB,   /* \b */
+	AS_NWORDB,  /* \B */
+	AS_WBEG,    /* \< */
+	AS_WEND     /* \> */
+};
+
+/* character types, as seen by assertions; T_BOUND is outside of text */
+enum {
+	T_BOUND,
+	T_NL,
+	T_WORD,
+	T_OTHER
+};
+
+enum {
+	N_EMPTY,
+	N_SET,
+	N_ASSERT,
+	N_CAT,
+	N_ALT,
+	N_REPEAT
+};
+
+struct Node {
+	int type;
+	int arg;        /* set index or assertion */
+	int min, max;   /* repetition; max is -1 if unbounded */
+	int left, right;
+};
+
+struct Inst {
+	int op, arg, x, y;
+};
+
+struct Prog {
+	Inst *inst;
+	int   ninst;
+	int   start;
+	bool  reversed;
+};
+
+struct DFA {
+	Prog *prog;
+	bool  unanchored;  /* program start is added at every position */
+
+	int   nstates, states_size;
+	int  *kernel_off;  /* program positions of each state are in kernel pool */
+	int  *kernel_len;
+	int  *type;        /* type of the last consumed character */
+	int  *trans;       /* (nclasses + 1) entries per state; -2 not computed, -1 dead */
+	int  *accept;      /* best tag + 1 if match ends before consuming the class */
+
+	int  *pool;
+	int   pool_len, pool_size;
+
+	int  *hash;        /* open addressing table of state indexes */
+	int   hash_size;
+
+	int   init[4];     /* start state for every type of preceding character */
+};
+
+struct HiRegex {
+	int flags;
+
+	Node *nodes;
+	int   nnodes;
+
+	unsigned int *sets;
+	int   nsets, sets_size;
+
+	unsigned char classes[256];
+	unsigned char class_rep[256]; /* some byte from each class */
+	unsigned char class_type[257];
+	int   nclasses;
+
+	Prog  fwd, rev;
+	DFA   longest;  /* forward, anchored */
+	DFA   search;   /* forward, unanchored */
+	DFA   starts;   /* reversed, unanchored */
+
+	/* scratch for closure computation */
+	int  *stack, *mark, *list;
+	int   markgen;
+
+	/* match starts found by backward pass; bit per text position */
+	unsigned int *bits;
+	int   bits_size;
+};
+
+/* parser */
+
+struct Parser {
+	HiRegex    *rx;
+	const char *p;
+	int         depth;
+	bool        error;
+	bool        backrefs; /* parse backreferences as any text; tree is then only searched for literals */
+};
+
+static bool is_word(int c) {
+	return isalnum(c) || c == '_';
+}
+
+static int char_type(int c) {
+	if(c == '\n') return T_NL;
+	return is_word(c) ? T_WORD : T_OTHER;
+}
+
+static int new_node(Parser *ps, int type, int arg, int left, int right) {
+	HiRegex *rx = ps->rx;
+
+	if(rx->nnodes >= MAX_NODES) {
+		ps->error = true;
+		return 0;
+	}
+
+	Node *n = &rx->nodes[rx->nnodes];
+	n->type  = type;
+	n->arg   = arg;
+	n->min   = n->max = 0;
+	n->left  = left;
+	n->right = right;
+	return rx->nnodes++;
+}
+
+static int new_set(HiRegex *rx) {
+	if(rx->nsets >= rx->sets_size) {
+		unsigned int *old = rx->sets;
+
+		rx->sets_size = rx->sets_size ? rx->sets_size * 2 : 16;
+		rx->sets = new unsigned int[rx->sets_size * SET_WORDS];
+
+		if(old) {
+			memcpy(rx->sets, old, sizeof(unsigned int) * SET_WORDS * rx->nsets);
+			delete [] old;
+		}
+	}
+
+	memset(rx->sets + rx->nsets * SET_WORDS, 0, sizeof(unsigned int) * SET_WORDS);
+	return rx->nsets++;
+}
+
+/* finish the set: apply case folding and newline rules, then wrap it in node */
+static int set_node(Parser *ps, int set, bool negate) {
+	HiRegex *rx = ps->rx;
+	unsigned int *s = rx->sets + set * SET_WORDS;
+
+	if(rx->flags & HI_REGEX_ICASE) {
+		for(int c = 0; c < 256; c++) {
+			if(SET_HAS(s, c)) {
+				SET_ADD(s, tolower(c));
+				SET_ADD(s, toupper(c));
+			}
+		}
+	}
+
+	if(negate) {
+		for(int i = 0; i < SET_WORDS; i++)
+			s[i] = ~s[i];
+		/* like regcomp(), negated list never matches NUL */
+		s[0] &= ~1U;
+	}
+
+	/* keep matches inside a line */
+	if(rx->flags & HI_REGEX_NEWLINE)
+		s['\n' >> 5] &= ~(1U << ('\n' & 31));
+
+	/* the same characters are usually repeated in pattern; share sets, so there is less to split into classes */
+	for(int i = 0; i < set; i++) {
+		if(memcmp(rx->sets + i * SET_WORDS, s, sizeof(unsigned int) * SET_WORDS) == 0) {
+			rx->nsets--;
+			set = i;
+			break;
+		}
+	}
+
+	return new_node(ps, N_SET, set, 0, 0);
+}
+
+static int char_node(Parser *ps, int c) {
+	int set = new_set(ps->rx);
+	SET_ADD(ps->rx->sets + set * SET_WORDS, c);
+	return set_node(ps, set, false);
+}
+
+static bool add_named_class(unsigned int *s, const char *name, int len) {
+	static const struct {
+		const char *name;
+		int (*fn)(int);
+	} names[] = {
+		{ "alpha",  isalpha },
+		{ "digit",  isdigit },
+		{ "alnum",  isalnum },
+		{ "upper",  isupper },
+		{ "lower",  islower },
+		{ "space",  isspace },
+		{ "blank",  isblank },
+		{ "punct",  ispunct },
+		{ "print",  isprint },
+		{ "graph",  isgraph },
+		{ "cntrl",  iscntrl },
+		{ "xdigit", isxdigit }
+	};
+
+	for(int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+		if((int)strlen(names[i].name) == len && strncmp(names[i].name, name, len) == 0) {
+			for(int c = 0; c < 256; c++) {
+				if(names[i].fn(c))
+					SET_ADD(s, c);
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* bracket expression; like in POSIX, backslash is ordinary character here */
+static int parse_bracket(Parser *ps) {
+	HiRegex *rx = ps->rx;
+	int set = new_set(rx), prev = -1;
+	bool negate = false, first = true;
+
+	if(*ps->p == '^') {
+		negate = true;
+		ps->p++;
+	}
+
+	while(true) {
+		unsigned int *s = rx->sets + set * SET_WORDS;
+		int c = (unsigned char)*ps->p;
+
+		if(!c) {
+			ps->error = true;
+			return 0;
+		}
+
+		if(c == ']' && !first) {
+			ps->p++;
+			break;
+		}
+
+		first = false;
+
+		if(c == '[' && (ps->p[1] == ':' || ps->p[1] == '=' || ps->p[1] == '.')) {
+			char kind = ps->p[1];
+			const char *name = ps->p + 2, *e = name;
+
+			while(*e && !(e[0] == kind && e[1] == ']'))
+				e++;
+
+			if(!*e) {
+				ps->error = true;
+				return 0;
+			}
+
+			if(kind == ':') {
+				if(!add_named_class(s, name, e - name)) {
+					ps->error = true;
+					return 0;
+				}
+				prev = -1;
+			} else {
+				/* only single character equivalence classes and collating elements */
+				if(e - name != 1) {
+					ps->error = true;
+					return 0;
+				}
+				prev = (unsigned char)name[0];
+				SET_ADD(s, prev);
+			}
+
+			ps->p = e + 2;
+			continue;
+		}
+
+		/* range */
+		if(c == '-' && prev != -1 && ps->p[1] && ps->p[1] != ']') {
+			int to = (unsigned char)ps->p[1];
+
+			if(to < prev) {
+				ps->error = true;
+				return 0;
+			}
+
+			for(int i = prev; i <= to; i++)
+				SET_ADD(s, i);
+
+			ps->p += 2;
+			prev = -1;
+			continue;
+		}
+
+		SET_ADD(s, c);
+		prev = c;
+		ps->p++;
+	}
+
+	return set_node(ps, set, negate);
+}
+
+static int parse_alt(Parser *ps);
+
+static int parse_escape(Parser *ps) {
+	HiRegex *rx = ps->rx;
+	int c = (unsigned char)*ps->p, set;
+
+	if(!c) {
+		ps->error = true;
+		return 0;
+	}
+
+	ps->p++;
+
+	switch(c) {
+		case 'w':
+		case 'W':
+			set = new_set(rx);
+			for(int i = 0; i < 256; i++) {
+				if(is_word(i))
+					SET_ADD(rx->sets + set * SET_WORDS, i);
+			}
+			return set_node(ps, set, c == 'W');
+		case 's':
+		case 'S':
+			set = new_set(rx);
+			for(int i = 0; i < 256; i++) {
+				if(isspace(i))
+					SET_ADD(rx->sets + set * SET_WORDS, i);
+			}
+			return set_node(ps, set, c == 'S');
+		case 'b':  return new_node(ps, N_ASSERT, AS_WORDB, 0, 0);
+		case 'B':  return new_node(ps, N_ASSERT, AS_NWORDB, 0, 0);
+		case '<':  return new_node(ps, N_ASSERT, AS_WBEG, 0, 0);
+		case '>':  return new_node(ps, N_ASSERT, AS_WEND, 0, 0);
+		case '`':  return new_node(ps, N_ASSERT, AS_BOT, 0, 0);
+		case '\'': return new_node(ps, N_ASSERT, AS_EOT, 0, 0);
+		default:
+			/* backreferences can't be done with DFA */
+			if(c >= '1' && c <= '9') {
+				if(!ps->backrefs) {
+					ps->error = true;
+					return 0;
+				}
+
+				set = new_set(rx);
+				for(int i = 1; i < 256; i++)
+					SET_ADD(rx->sets + set * SET_WORDS, i);
+
+				int n = new_node(ps, N_REPEAT, 0, set_node(ps, set, false), 0);
+				rx->nodes[n].min = 0;
+				rx->nodes[n].max = -1;
+				return n;
+			}
+
+			return char_node(ps, c);
+	}
+}
+
+static int parse_atom(Parser *ps) {
+	int c = (unsigned char)*ps->p, n;
+
+	switch(c) {
+		case '(':
+			ps->p++;
+			ps->depth++;
+
+			n = parse_alt(ps);
+			if(*ps->p != ')') {
+				ps->error = true;
+				return 0;
+			}
+
+			ps->p++;
+			ps->depth--;
+			return n;
+		case '[':
+			ps->p++;
+			return parse_bracket(ps);
+		case '.': {
+			ps->p++;
+			int set = new_set(ps->rx);
+			for(int i = 1; i < 256; i++)
+				SET_ADD(ps->rx->sets + set * SET_WORDS, i);
+			return set_node(ps, set, false);
+		}
+		case '^':
+			ps->p++;
+			return new_node(ps, N_ASSERT, AS_BOL, 0, 0);
+		case '$':
+			ps->p++;
+			return new_node(ps, N_ASSERT, AS_EOL, 0, 0);
+		case '\\':
+			ps->p++;
+			return parse_escape(ps);
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+			/* repetition without anything to repeat */
+			ps->error = true;
+			return 0;
+		default:
+			ps->p++;
+			return char_node(ps, c);
+	}
+}
+
+static bool parse_number(Parser *ps, int *n) {
+	if(!isdigit((unsigned char)*ps->p)) return false;
+
+	*n = 0;
+	while(isdigit((unsigned char)*ps->p)) {
+		*n = *n * 10 + (*ps->p - '0');
+		if(*n > 255) return false;
+		ps->p++;
+	}
+
+	return true;
+}
+
+static int parse_repeat(Parser *ps) {
+	int n = parse_atom(ps);
+
+	while(!ps->error) {
+		int c = *ps->p, min, max;
+
+		if(c == '*') {
+			min = 0; max = -1;
+			ps->p++;
+		} else if(c == '+') {
+			min = 1; max = -1;
+			ps->p++;
+		} else if(c == '?') {
+			min = 0; max = 1;
+			ps->p++;
+		} else if(c == '{') {
+			ps->p++;
+			if(!parse_number(ps, &min)) {
+				ps->error = true;
+				break;
+			}
+
+			max = min;
+			if(*ps->p == ',') {
+				ps->p++;
+				if(!parse_number(ps, &max))
+					max = -1;
+			}
+
+			if(*ps->p != '}' || (max != -1 && max < min)) {
+				ps->error = true;
+				break;
+			}
+
+			ps->p++;
+		} else {
+			break;
+		}
+
+		n = new_node(ps, N_REPEAT, 0, n, 0);
+		ps->rx->nodes[n].min = min;
+		ps->rx->nodes[n].max = max;
+	}
+
+	return n;
+}
+
+static int parse_cat(Parser *ps) {
+	int n = -1;
+
+	while(!ps->error && *ps->p && *ps->p != '|' && !(*ps->p == ')' && ps->depth > 0)) {
+		int r = parse_repeat(ps);
+		n = (n == -1) ? r : new_node(ps, N_CAT, 0, n, r);
+	}
+
+	return (n == -1) ? new_node(ps, N_EMPTY, 0, 0, 0) : n;
+}
+
+static int parse_alt(Parser *ps) {
+	int n = parse_cat(ps);
+
+	while(!ps->error && *ps->p == '|') {
+		ps->p++;
+		n = new_node(ps, N_ALT, 0, n, parse_cat(ps));
+	}
+
+	return n;
+}
+
+/* compiler */
+
+static int emit(Prog *pg, int op, int arg, int x, int y) {
+	if(pg->ninst >= MAX_INST) return -1;
+
+	Inst *i = &pg->inst[pg->ninst];
+	i->op  = op;
+	i->arg = arg;
+	i->x   = x;
+	i->y   = y;
+	return pg->ninst++;
+}
+
+/* emit code for node 'n'; returns false if program got too large */
+static bool compile_node(HiRegex *rx, Prog *pg, int n) {
+	Node *nd = &rx->nodes[n];
+	int split, jmp, i;
+
+	switch(nd->type) {
+		case N_EMPTY:
+			return true;
+		case N_SET:
+			return emit(pg, OP_SET, nd->arg, 0, 0) != -1;
+		case N_ASSERT:
+			return emit(pg, OP_ASSERT, nd->arg, 0, 0) != -1;
+		case N_CAT:
+			/* reversed program matches the same text backwards */
+			if(pg->reversed)
+				return compile_node(rx, pg, nd->right) && compile_node(rx, pg, nd->left);
+			return compile_node(rx, pg, nd->left) && compile_node(rx, pg, nd->right);
+		case N_ALT:
+			if((split = emit(pg, OP_SPLIT, 0, 0, 0)) == -1) return false;
+			pg->inst[split].x = pg->ninst;
+
+			if(!compile_node(rx, pg, nd->left)) return false;
+			if((jmp = emit(pg, OP_JMP, 0, 0, 0)) == -1) return false;
+
+			pg->inst[split].y = pg->ninst;
+			if(!compile_node(rx, pg, nd->right)) return false;
+
+			pg->inst[jmp].x = pg->ninst;
+			return true;
+		case N_REPEAT:
+			/* mandatory copies first, then optional ones or the loop */
+			for(i = 0; i < nd->min; i++) {
+				if(!compile_node(rx, pg, nd->left)) return false;
+			}
+
+			if(nd->max == -1) {
+				if((split = emit(pg, OP_SPLIT, 0, 0, 0)) == -1) return false;
+				pg->inst[split].x = pg->ninst;
+
+				if(!compile_node(rx, pg, nd->left)) return false;
+				if(emit(pg, OP_JMP, 0, split, 0) == -1) return false;
+
+				pg->inst[split].y = pg->ninst;
+				return true;
+			}
+
+			for(; i < nd->max; i++) {
+				if((split = emit(pg, OP_SPLIT, 0, 0, 0)) == -1) return false;
+				pg->inst[split].x = pg->ninst;
+
+				if(!compile_node(rx, pg, nd->left)) return false;
+				pg->inst[split].y = pg->ninst;
+			}
+			return true;
+	}
+
+	return false;
+}
+
+/* every pattern gets own branch, ending with match tagged by pattern index */
+static bool compile_prog(HiRegex *rx, Prog *pg, const int *roots, int nroots, bool reversed) {
+	pg->inst     = new Inst[MAX_INST];
+	pg->ninst    = 0;
+	pg->start    = 0;
+	pg->reversed = reversed;
+
+	for(int i = 0; i < nroots; i++) {
+		int split = -1;
+
+		if(i < nroots - 1) {
+			if((split = emit(pg, OP_SPLIT, 0, 0, 0)) == -1) return false;
+			pg->inst[split].x = pg->ninst;
+		}
+
+		if(!compile_node(rx, pg, roots[i]) || emit(pg, OP_MATCH, i, 0, 0) == -1)
+			return false;
+
+		if(split != -1)
+			pg->inst[split].y = pg->ninst;
+	}
+
+	/* keep only what was used */
+	Inst *inst = new Inst[pg->ninst];
+	memcpy(inst, pg->inst, sizeof(Inst) * pg->ninst);
+	delete [] pg->inst;
+	pg->inst = inst;
+	return true;
+}
+
+/* split bytes into classes, where all bytes in the same class behave the same in every set and assertion */
+static void compute_classes(HiRegex *rx) {
+	unsigned int word[SET_WORDS], nl[SET_WORDS];
+	int count[256], inside[256], remap[256];
+
+	memset(word, 0, sizeof(word));
+	memset(nl, 0, sizeof(nl));
+	for(int c = 0; c < 256; c++) {
+		if(is_word(c)) SET_ADD(word, c);
+	}
+	SET_ADD(nl, '\n');
+
+	memset(rx->classes, 0, sizeof(rx->classes));
+	rx->nclasses = 1;
+
+	for(int i = -2; i < rx->nsets; i++) {
+		unsigned int *s = (i == -2) ? word : (i == -1) ? nl : rx->sets + i * SET_WORDS;
+
+		memset(count, 0, sizeof(count));
+		memset(inside, 0, sizeof(inside));
+
+		for(int c = 0; c < 256; c++) {
+			count[rx->classes[c]]++;
+			if(SET_HAS(s, c)) inside[rx->classes[c]]++;
+		}
+
+		/* only classes partially inside the set are split */
+		for(int k = 0; k < 256; k++)
+			remap[k] = (inside[k] && inside[k] != count[k]) ? rx->nclasses++ : -1;
+
+		for(int c = 0; c < 256; c++) {
+			if(SET_HAS(s, c) && remap[rx->classes[c]] != -1)
+				rx->classes[c] = remap[rx->classes[c]];
+		}
+	}
+
+	for(int c = 255; c >= 0; c--) {
+		rx->class_rep[rx->classes[c]] = c;
+		rx->class_type[rx->classes[c]] = char_type(c);
+	}
+
+	/* pseudo class for text boundary */
+	rx->class_type[rx->nclasses] = T_BOUND;
+}
+
+/* DFA */
+
+static void dfa_init(DFA *d, Prog *prog, bool unanchored) {
+	d->prog = prog;
+	d->unanchored = unanchored;
+	d->nstates = d->states_size = 0;
+	d->kernel_off = d->kernel_len = d->type = NULL;
+	d->trans = d->accept = NULL;
+	d->pool = NULL;
+	d->pool_len = d->pool_size = 0;
+	d->hash = NULL;
+	d->hash_size = 0;
+
+	for(int i = 0; i < 4; i++)
+		d->init[i] = -1;
+}
+
+static void dfa_free(DFA *d) {
+	delete [] d->kernel_off;
+	delete [] d->kernel_len;
+	delete [] d->type;
+	delete [] d->trans;
+	delete [] d->accept;
+	delete [] d->pool;
+	delete [] d->hash;
+	dfa_init(d, d->prog, d->unanchored);
+}
+
+static void dfa_reset(DFA *d) {
+	d->nstates  = 0;
+	d->pool_len = 0;
+
+	for(int i = 0; i < d->hash_size; i++)
+		d->hash[i] = -1;
+
+	for(int i = 0; i < 4; i++)
+		d->init[i] = -1;
+}
+
+static long dfa_memory(HiRegex *rx, DFA *d) {
+	return (long)d->states_size * (sizeof(int) * 3 + sizeof(int) * 2 * (rx->nclasses + 1)) +
+		   (long)d->pool_size * sizeof(int) + (long)d->hash_size * sizeof(int);
+}
+
+static unsigned int hash_kernel(const int *k, int len, int type) {
+	unsigned int h = 2166136261U ^ type;
+	for(int i = 0; i < len; i++)
+		h = (h ^ (unsigned int)k[i]) * 16777619U;
+	return h;
+}
+
+/* find or add state with given kernel; returns state index */
+static int dfa_state(HiRegex *rx, DFA *d, const int *kernel, int len, int type) {
+	unsigned int h;
+	int i, w = rx->nclasses + 1;
+
+	if(d->hash_size) {
+		h = hash_kernel(kernel, len, type) & (d->hash_size - 1);
+
+		for(i = d->hash[h]; i != -1; i = d->hash[h = (h + 1) & (d->hash_size - 1)]) {
+			if(d->type[i] == type && d->kernel_len[i] == len &&
+			   (!len || memcmp(d->pool + d->kernel_off[i], kernel, sizeof(int) * len) == 0))
+			{
+				return i;
+			}
+		}
+	}
+
+	/* grow state arrays */
+	if(d->nstates >= d->states_size) {
+		int n = d->states_size ? d->states_size * 2 : 16;
+
+		int *koff = new int[n], *klen = new int[n], *tp = new int[n];
+		int *tr = new int[n * w], *ac = new int[n * w];
+
+		if(d->nstates) {
+			memcpy(koff, d->kernel_off, sizeof(int) * d->nstates);
+			memcpy(klen, d->kernel_len, sizeof(int) * d->nstates);
+			memcpy(tp, d->type, sizeof(int) * d->nstates);
+			memcpy(tr, d->trans, sizeof(int) * d->nstates * w);
+			memcpy(ac, d->accept, sizeof(int) * d->nstates * w);
+		}
+
+		delete [] d->kernel_off;
+		delete [] d->kernel_len;
+		delete [] d->type;
+		delete [] d->trans;
+		delete [] d->accept;
+
+		d->kernel_off = koff;
+		d->kernel_len = klen;
+		d->type   = tp;
+		d->trans  = tr;
+		d->accept = ac;
+		d->states_size = n;
+
+		/* rehash with load factor below 1/2 */
+		delete [] d->hash;
+		d->hash_size = n * 2;
+		d->hash = new int[d->hash_size];
+
+		for(i = 0; i < d->hash_size; i++)
+			d->hash[i] = -1;
+
+		for(i = 0; i < d->nstates; i++) {
+			h = hash_kernel(d->pool + d->kernel_off[i], d->kernel_len[i], d->type[i]) & (d->hash_size - 1);
+			while(d->hash[h] != -1)
+				h = (h + 1) & (d->hash_size - 1);
+			d->hash[h] = i;
+		}
+	}
+
+	if(d->pool_len + len > d->pool_size) {
+		int *old = d->pool;
+
+		d->pool_size = d->pool_size ? d->pool_size * 2 : 256;
+		while(d->pool_size < d->pool_len + len)
+			d->pool_size *= 2;
+
+		d->pool = new int[d->pool_size];
+		if(old) {
+			memcpy(d->pool, old, sizeof(int) * d->pool_len);
+			delete [] old;
+		}
+	}
+
+	i = d->nstates++;
+	d->kernel_off[i] = d->pool_len;
+	d->kernel_len[i] = len;
+	d->type[i] = type;
+	if(len) memcpy(d->pool + d->pool_len, kernel, sizeof(int) * len);
+	d->pool_len += len;
+
+	for(int c = 0; c < w; c++) {
+		d->trans[i * w + c]  = -2;
+		d->accept[i * w + c] = 0;
+	}
+
+	h = hash_kernel(kernel, len, type) & (d->hash_size - 1);
+	while(d->hash[h] != -1)
+		h = (h + 1) & (d->hash_size - 1);
+	d->hash[h] = i;
+
+	return i;
+}
+
+/* check assertion with character types on the left and right side of the current position */
+static bool assertion_holds(HiRegex *rx, int as, int left, int right) {
+	bool nl = (rx->flags & HI_REGEX_NEWLINE) != 0;
+
+	switch(as) {
+		case AS_BOL:    return left == T_BOUND || (nl && left == T_NL);
+		case AS_EOL:    return right == T_BOUND || (nl && right == T_NL);
+		case AS_BOT:    return left == T_BOUND;
+		case AS_EOT:    return right == T_BOUND;
+		case AS_WORDB:  return (left == T_WORD) != (right == T_WORD);
+		case AS_NWORDB: return (left == T_WORD) == (right == T_WORD);
+		case AS_WBEG:   return left != T_WORD && right == T_WORD;
+		case AS_WEND:   return left == T_WORD && right != T_WORD;
+	}
+
+	return false;
+}
+
+static int cmp_int(const void *a, const void *b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+/*
+ * Compute transition from state 's' on class 'cls'. Epsilon closure is done here, because assertions can be
+ * checked only when the character after current position is known. Returns target state (-1 if dead) and sets
+ * 'acc' to best matched tag + 1 (0 if no match) at current position. Cache can be flushed, so 's' is not valid
+ * after this call.
+ */
+static int dfa_step(HiRegex *rx, DFA *d, int s, int cls, int *acc) {
+	Prog *pg = d->prog;
+	int w = rx->nclasses + 1, nlist = 0, sp = 0, pc, left, right, c;
+
+	/* types on both sides of current position; reversed program sees text from the other side */
+	left  = d->type[s];
+	right = rx->class_type[cls];
+	if(pg->reversed) {
+		int t = left;
+		left  = right;
+		right = t;
+	}
+
+	if(++rx->markgen == 0) {
+		memset(rx->mark, 0, sizeof(int) * rx->fwd.ninst);
+		rx->markgen = 1;
+	}
+
+	for(int i = d->kernel_len[s] - 1; i >= 0; i--)
+		rx->stack[sp++] = d->pool[d->kernel_off[s] + i];
+	if(d->unanchored)
+		rx->stack[sp++] = pg->start;
+
+	*acc = 0;
+
+	while(sp > 0) {
+		pc = rx->stack[--sp];
+		if(rx->mark[pc] == rx->markgen) continue;
+		rx->mark[pc] = rx->markgen;
+
+		Inst *in = &pg->inst[pc];
+		switch(in->op) {
+			case OP_SET:
+				rx->list[nlist++] = pc;
+				break;
+			case OP_SPLIT:
+				rx->stack[sp++] = in->y;
+				rx->stack[sp++] = in->x;
+				break;
+			case OP_JMP:
+				rx->stack[sp++] = in->x;
+				break;
+			case OP_ASSERT:
+				if(assertion_holds(rx, in->arg, left, right))
+					rx->stack[sp++] = pc + 1;
+				break;
+			case OP_MATCH:
+				if(in->arg + 1 > *acc) *acc = in->arg + 1;
+				break;
+		}
+	}
+
+	d->accept[s * w + cls] = *acc;
+
+	/* boundary pseudo class has no target state */
+	if(cls == rx->nclasses) return -1;
+
+	/* consume the character; its representative byte behaves the same as every other byte from class */
+	c = rx->class_rep[cls];
+	int nkernel = 0;
+	for(int i = 0; i < nlist; i++) {
+		Inst *in = &pg->inst[rx->list[i]];
+		if(SET_HAS(rx->sets + in->arg * SET_WORDS, c))
+			rx->list[nkernel++] = rx->list[i] + 1;
+	}
+
+	if(!nkernel && !d->unanchored) {
+		d->trans[s * w + cls] = -1;
+		return -1;
+	}
+
+	qsort(rx->list, nkernel, sizeof(int), cmp_int);
+
+	if(d->nstates >= MAX_DFA_STATES) {
+		dfa_reset(d);
+		return dfa_state(rx, d, rx->list, nkernel, rx->class_type[cls]);
+	}
+
+	int t = dfa_state(rx, d, rx->list, nkernel, rx->class_type[cls]);
+	d->trans[s * w + cls] = t;
+	return t;
+}
+
+static int dfa_start(HiRegex *rx, DFA *d, int type) {
+	if(d->init[type] == -1) {
+		int start = d->prog->start;
+		d->init[type] = d->unanchored ? dfa_state(rx, d, NULL, 0, type) : dfa_state(rx, d, &start, 1, type);
+	}
+
+	return d->init[type];
+}
+
+#define DFA_NEXT(rx, d, s, cls, acc)                             \
+	do {                                                         \
+		int _w = (rx)->nclasses + 1;                             \
+		int _t = (d)->trans[(s) * _w + (cls)];                   \
+		if(_t == -2) {                                           \
+			_t = dfa_step(rx, d, s, cls, &(acc));                \
+		} else {                                                 \
+			acc = (d)->accept[(s) * _w + (cls)];                 \
+		}                                                        \
+		s = _t;                                                  \
+	} while(0)
+
+/* type of character before position 'pos' */
+static int type_before(const char *text, int pos) {
+	return pos > 0 ? char_type((unsigned char)text[pos - 1]) : T_BOUND;
+}
+
+/*
+ * Longest match starting exactly at 'pos'; returns end or -1. 'tag' is set to the highest pattern index matching
+ * up to that end.
+ */
+static int dfa_longest(HiRegex *rx, const char *text, int len, int pos, int *tag) {
+	DFA *d = &rx->longest;
+	int s = dfa_start(rx, d, type_before(text, pos)), acc = 0, end = -1;
+
+	for(int i = pos; i < len; i++) {
+		DFA_NEXT(rx, d, s, rx->classes[(unsigned char)text[i]], acc);
+		if(acc) {
+			end  = i;
+			*tag = acc - 1;
+		}
+		if(s == -1) return end;
+	}
+
+	DFA_NEXT(rx, d, s, rx->nclasses, acc);
+	if(acc) {
+		end  = len;
+		*tag = acc - 1;
+	}
+
+	return end;
+}
+
+/* mark every position in [from, len] where some match starts */
+static void dfa_mark_starts(HiRegex *rx, const char *text, int len, int from) {
+	DFA *d = &rx->starts;
+	int n = (len >> 5) + 1, s, acc = 0;
+
+	if(n > rx->bits_size) {
+		delete [] rx->bits;
+		rx->bits_size = n;
+		rx->bits = new unsigned int[n];
+	}
+
+	memset(rx->bits, 0, sizeof(unsigned int) * n);
+
+	/* going backwards, the character after position was consumed last */
+	s = dfa_start(rx, d, T_BOUND);
+
+	for(int i = len; i > from; i--) {
+		DFA_NEXT(rx, d, s, rx->classes[(unsigned char)text[i - 1]], acc);
+		if(acc) SET_ADD(rx->bits, i);
+	}
+
+	/* at 'from', character before it is context only */
+	if(from > 0)
+		DFA_NEXT(rx, d, s, rx->classes[(unsigned char)text[from - 1]], acc);
+	else
+		DFA_NEXT(rx, d, s, rx->nclasses, acc);
+
+	if(acc) SET_ADD(rx->bits, from);
+}
+
+static int next_start(HiRegex *rx, int pos, int len) {
+	while(pos <= len) {
+		unsigned int w = rx->bits[pos >> 5] >> (pos & 31);
+		if(w) return pos + __builtin_ctz(w);
+		pos = (pos | 31) + 1;
+	}
+
+	return -1;
+}
+
+/* literal extraction */
+
+#define LIT_LEN 16 /* longer literals are cut; part of a literal every match contains is in every match too */
+
+enum {
+	CUT_NONE, /* too long concatenation is not known */
+	CUT_TAIL, /* keep the beginning */
+	CUT_HEAD  /* keep the end */
+};
+
+/* set of strings; 'n' is -1 if set is not known */
+struct LitSet {
+	int  n;
+	int  len[HI_REGEX_MAX_LITERALS];
+	char s[HI_REGEX_MAX_LITERALS][LIT_LEN];
+};
+
+/*
+ * What is known about text matched by syntax tree node: 'exact' are all the strings it can match, every one starts
+ * with one of 'prefix', ends with one of 'suffix' and contains one of 'req'. Unknown prefix and suffix are the empty
+ * string.
+ */
+struct LitInfo {
+	LitSet exact, prefix, suffix, req;
+};
+
+static void lit_empty(LitSet *ls) {
+	ls->n = 1;
+	ls->len[0] = 0;
+}
+
+static bool lit_add(LitSet *ls, const char *str, int len) {
+	for(int i = 0; i < ls->n; i++) {
+		if(ls->len[i] == len && memcmp(ls->s[i], str, len) == 0)
+			return true;
+	}
+
+	if(ls->n >= HI_REGEX_MAX_LITERALS) return false;
+
+	memcpy(ls->s[ls->n], str, len);
+	ls->len[ls->n++] = len;
+	return true;
+}
+
+/* union of 'a' and 'b', with strings cut to 'keep' characters (from the side given by 'cut') */
+static bool lit_union(LitSet *out, const LitSet *a, const LitSet *b, int cut, int keep) {
+	const LitSet *from[2] = { a, b };
+	LitSet tmp;
+
+	tmp.n = 0;
+	if(a->n < 0 || b->n < 0) {
+		out->n = -1;
+		return false;
+	}
+
+	for(int k = 0; k < 2; k++) {
+		for(int i = 0; i < from[k]->n; i++) {
+			int len = from[k]->len[i], skip = 0;
+
+			if(len > keep) {
+				skip = (cut == CUT_HEAD) ? len - keep : 0;
+				len  = keep;
+			}
+
+			if(!lit_add(&tmp, from[k]->s[i] + skip, len)) {
+				out->n = -1;
+				return false;
+			}
+		}
+	}
+
+	*out = tmp;
+	return true;
+}
+
+/* every string of 'a' followed by every string of 'b' */
+static bool lit_cat(LitSet *out, const LitSet *a, const LitSet *b, int cut) {
+	char buf[LIT_LEN * 2];
+	LitSet tmp;
+
+	tmp.n = 0;
+	if(a->n < 0 || b->n < 0) {
+		out->n = -1;
+		return false;
+	}
+
+	for(int i = 0; i < a->n; i++) {
+		for(int j = 0; j < b->n; j++) {
+			int len = a->len[i] + b->len[j], skip = 0;
+
+			memcpy(buf, a->s[i], a->len[i]);
+			memcpy(buf + a->len[i], b->s[j], b->len[j]);
+
+			if(len > LIT_LEN) {
+				if(cut == CUT_NONE) {
+					out->n = -1;
+					return false;
+				}
+
+				skip = (cut == CUT_HEAD) ? len - LIT_LEN : 0;
+				len  = LIT_LEN;
+			}
+
+			if(!lit_add(&tmp, buf + skip, len)) {
+				out->n = -1;
+				return false;
+			}
+		}
+	}
+
+	*out = tmp;
+	return true;
+}
+
+/* how useful is set for skipping text: the longer its shortest string is and the less strings, the better */
+static int lit_score(const LitSet *ls) {
+	if(ls->n < 1) return -1;
+
+	int shortest = LIT_LEN;
+	for(int i = 0; i < ls->n; i++) {
+		if(ls->len[i] < shortest)
+			shortest = ls->len[i];
+	}
+
+	/* empty string is always found; many single characters (e.g. \s) are found almost everywhere */
+	if(!shortest || (shortest == 1 && ls->n > HI_REGEX_MAX_LITERALS / 2)) return -1;
+	return shortest * (HI_REGEX_MAX_LITERALS + 1) + HI_REGEX_MAX_LITERALS - ls->n;
+}
+
+static void lit_better(LitSet *req, const LitSet *cand) {
+	if(lit_score(cand) > lit_score(req))
+		*req = *cand;
+}
+
+static bool lit_node(HiRegex *rx, LitInfo *info, int i) {
+	Node    *n = &rx->nodes[i];
+	LitInfo *r = &info[i], *a, *b;
+	LitSet   tmp;
+
+	r->req.n = -1;
+
+	switch(n->type) {
+		case N_EMPTY:
+			lit_empty(&r->exact);
+			break;
+		case N_ASSERT:
+			/* these depend on where text ends, not on lines, so text can't be cut into lines around literals */
+			if(n->arg == AS_BOT || n->arg == AS_EOT) return false;
+			lit_empty(&r->exact);
+			break;
+		case N_SET: {
+			unsigned int *set = rx->sets + n->arg * SET_WORDS;
+
+			r->exact.n = 0;
+			for(int c = 0; c < 256 && r->exact.n >= 0; c++) {
+				char ch = (char)c;
+				if(SET_HAS(set, c) && !lit_add(&r->exact, &ch, 1))
+					r->exact.n = -1;
+			}
+			break;
+		}
+		case N_CAT:
+			a = &info[n->left];
+			b = &info[n->right];
+
+			lit_cat(&r->exact, &a->exact, &b->exact, CUT_NONE);
+
+			if(a->exact.n < 0 || !lit_cat(&r->prefix, &a->exact, &b->prefix, CUT_TAIL))
+				r->prefix = (a->exact.n >= 0) ? a->exact : a->prefix;
+			if(b->exact.n < 0 || !lit_cat(&r->suffix, &a->suffix, &b->exact, CUT_HEAD))
+				r->suffix = (b->exact.n >= 0) ? b->exact : b->suffix;
+
+			/* literal can also be made of the end of one part and the beginning of the other */
+			r->req = a->req;
+			lit_better(&r->req, &b->req);
+			if(lit_cat(&tmp, &a->suffix, &b->prefix, CUT_TAIL))
+				lit_better(&r->req, &tmp);
+			break;
+		case N_ALT:
+			a = &info[n->left];
+			b = &info[n->right];
+
+			lit_union(&r->exact, &a->exact, &b->exact, CUT_NONE, LIT_LEN);
+
+			/* too many different strings; the first (or last) characters can still be the same */
+			if(!lit_union(&r->prefix, &a->prefix, &b->prefix, CUT_TAIL, LIT_LEN) &&
+			   !lit_union(&r->prefix, &a->prefix, &b->prefix, CUT_TAIL, 1))
+				lit_empty(&r->prefix);
+			if(!lit_union(&r->suffix, &a->suffix, &b->suffix, CUT_HEAD, LIT_LEN) &&
+			   !lit_union(&r->suffix, &a->suffix, &b->suffix, CUT_HEAD, 1))
+				lit_empty(&r->suffix);
+
+			if(!lit_union(&r->req, &a->req, &b->req, CUT_TAIL, LIT_LEN))
+				lit_union(&r->req, &a->req, &b->req, CUT_TAIL, 1);
+			break;
+		case N_REPEAT:
+			a = &info[n->left];
+
+			if(n->min == 0) {
+				if(n->max == 0)
+					lit_empty(&r->exact);
+				else
+					r->exact.n = -1;
+				break;
+			}
+
+			if(n->min == 1 && n->max == 1)
+				r->exact = a->exact;
+			else
+				r->exact.n = -1;
+
+			r->prefix = a->prefix;
+			r->suffix = a->suffix;
+			r->req    = a->req;
+			break;
+	}
+
+	/* without anything better known, prefix and suffix are the empty string */
+	if(n->type != N_CAT && n->type != N_ALT && !(n->type == N_REPEAT && n->min > 0)) {
+		if(r->exact.n >= 0) {
+			r->prefix = r->exact;
+			r->suffix = r->exact;
+		} else {
+			lit_empty(&r->prefix);
+			lit_empty(&r->suffix);
+		}
+	}
+
+	lit_better(&r->req, &r->exact);
+	lit_better(&r->req, &r->prefix);
+	lit_better(&r->req, &r->suffix);
+	return true;
+}
+
+/* syntax tree of pattern, for the analysis below; backreferences are accepted, as any text. NULL if it is invalid */
+static HiRegex *parse_tree(const char *pattern, int flags, int *root) {
+	HiRegex *rx = new HiRegex;
+	memset(rx, 0, sizeof(HiRegex));
+	rx->flags = flags;
+	rx->nodes = new Node[MAX_NODES];
+
+	Parser ps;
+	ps.rx       = rx;
+	ps.p        = pattern;
+	ps.depth    = 0;
+	ps.error    = false;
+	ps.backrefs = true;
+
+	*root = parse_alt(&ps);
+
+	if(ps.error || *ps.p) {
+		hi_regex_free(rx);
+		return NULL;
+	}
+
+	return rx;
+}
+
+int hi_regex_literals(const char *pattern, int flags, char **lits, int *lens) {
+	/* text would have to be searched without case */
+	if(flags & HI_REGEX_ICASE) return 0;
+
+	int root, ret = 0;
+	HiRegex *rx = parse_tree(pattern, flags, &root);
+
+	if(rx) {
+		/* children are always created before their parents */
+		LitInfo *info = new LitInfo[rx->nnodes];
+		bool     ok   = true;
+
+		for(int i = 0; i < rx->nnodes && ok; i++)
+			ok = lit_node(rx, info, i);
+
+		if(ok && lit_score(&info[root].req) > 0) {
+			LitSet *req = &info[root].req;
+
+			for(ret = 0; ret < req->n; ret++) {
+				lits[ret] = (char*)malloc(req->len[ret] + 1);
+				memcpy(lits[ret], req->s[ret], req->len[ret]);
+				lits[ret][req->len[ret]] = '\0';
+				lens[ret] = req->len[ret];
+			}
+		}
+
+		delete [] info;
+		hi_regex_free(rx);
+	}
+
+	return ret;
+}
+
+bool hi_regex_line_anchored(const char *pattern, int flags) {
+	/* without HI_REGEX_NEWLINE, '^' matches only at the start of the text */
+	if(!(flags & HI_REGEX_NEWLINE)) return false;
+
+	int root;
+	HiRegex *rx = parse_tree(pattern, flags, &root);
+	if(!rx) return false;
+
+	/* anchored[i]: every match of node i starts with '^'; empty[i]: node matches only the empty string */
+	bool *anchored = new bool[rx->nnodes], *empty = new bool[rx->nnodes], ret;
+
+	/* children are always created before their parents */
+	for(int i = 0; i < rx->nnodes; i++) {
+		Node *n = &rx->nodes[i];
+
+		switch(n->type) {
+			case N_EMPTY:
+				anchored[i] = false;
+				empty[i]    = true;
+				break;
+			case N_ASSERT:
+				anchored[i] = (n->arg == AS_BOL);
+				empty[i]    = true;
+				break;
+			case N_CAT:
+				anchored[i] = anchored[n->left] || (empty[n->left] && anchored[n->right]);
+				empty[i]    = empty[n->left] && empty[n->right];
+				break;
+			case N_ALT:
+				anchored[i] = anchored[n->left] && anchored[n->right];
+				empty[i]    = empty[n->left] && empty[n->right];
+				break;
+			case N_REPEAT:
+				anchored[i] = n->min > 0 && anchored[n->left];
+				empty[i]    = n->max == 0 || empty[n->left];
+				break;
+			default:
+				anchored[i] = empty[i] = false;
+				break;
+		}
+	}
+
+	ret = anchored[root];
+
+	delete [] anchored;
+	delete [] empty;
+	hi_regex_free(rx);
+	return ret;
+}
+
+/* public interface */
+
+char *hi_regex_quote(const char *str) {
+	/* the worst case is every character wrapped as [c] */
+	char *ret = (char*)malloc(strlen(str) * 3 + 1), *p = ret;
+
+	for(; *str; str++) {
+		unsigned char c = *str;
+
+		if(isalnum(c)) {
+			*p++ = c;
+		} else if(strchr("<>`'", c)) {
+			/* escaped, these would be assertions */
+			*p++ = '[';
+			*p++ = c;
+			*p++ = ']';
+		} else {
+			*p++ = '\\';
+			*p++ = c;
+		}
+	}
+
+	*p = '\0';
+	return ret;
+}
+
+/* empty DFAs and scratch for closure computation, once both programs are known */
+static void init_matching(HiRegex *rx) {
+	dfa_init(&rx->longest, &rx->fwd, false);
+	dfa_init(&rx->search, &rx->fwd, true);
+	dfa_init(&rx->starts, &rx->rev, true);
+
+	/* both programs have the same size; every position is pushed at most twice, plus the kernel */
+	int n = rx->fwd.ninst;
+	rx->stack = new int[n * 3 + 1];
+	rx->mark  = new int[n];
+	rx->list  = new int[n];
+	memset(rx->mark, 0, sizeof(int) * n);
+}
+
+HiRegex *hi_regex_compile(const char *pattern, int flags) {
+	return hi_regex_compile_set(&pattern, 1, flags);
+}
+
+HiRegex *hi_regex_compile_set(const char **patterns, int npatterns, int flags) {
+	if(npatterns < 1) return NULL;
+
+	HiRegex *rx = new HiRegex;
+	memset(rx, 0, sizeof(HiRegex));
+	rx->flags = flags;
+	rx->nodes = new Node[MAX_NODES];
+
+	Parser ps;
+	ps.rx = rx;
+	ps.error = false;
+	ps.backrefs = false;
+
+	int *roots = new int[npatterns];
+	for(int i = 0; i < npatterns && !ps.error; i++) {
+		ps.p     = patterns[i];
+		ps.depth = 0;
+		roots[i] = parse_alt(&ps);
+
+		if(*ps.p) ps.error = true;
+	}
+
+	bool ok = !ps.error &&
+			  compile_prog(rx, &rx->fwd, roots, npatterns, false) &&
+			  compile_prog(rx, &rx->rev, roots, npatterns, true);
+
+	delete [] roots;
+
+	if(!ok) {
+		hi_regex_free(rx);
+		return NULL;
+	}
+
+	/* syntax tree is not needed anymore */
+	delete [] rx->nodes;
+	rx->nodes = NULL;
+
+	compute_classes(rx);
+	init_matching(rx);
+	return rx;
+}
+
+HiRegex *hi_regex_clone(const HiRegex *rx) {
+	HiRegex *c = new HiRegex;
+	memcpy(c, rx, sizeof(HiRegex));
+
+	c->nodes = NULL;
+	c->sets  = NULL;
+	if(rx->nsets) {
+		c->sets = new unsigned int[rx->nsets * SET_WORDS];
+		memcpy(c->sets, rx->sets, sizeof(unsigned int) * rx->nsets * SET_WORDS);
+	}
+	c->sets_size = rx->nsets;
+
+	c->fwd.inst = new Inst[rx->fwd.ninst];
+	c->rev.inst = new Inst[rx->rev.ninst];
+	memcpy(c->fwd.inst, rx->fwd.inst, sizeof(Inst) * rx->fwd.ninst);
+	memcpy(c->rev.inst, rx->rev.inst, sizeof(Inst) * rx->rev.ninst);
+
+	init_matching(c);
+	c->markgen = 0;
+
+	c->bits = NULL;
+	c->bits_size = 0;
+	return c;
+}
+
+static void save_prog(const Prog *pg, HiImageWriter *w) {
+	w->put_int(pg->ninst);
+	w->put_int(pg->start);
+	w->put(pg->inst, sizeof(Inst) * pg->ninst);
+}
+
+/* read program and check every instruction, so damaged image can't make matching step outside of it */
+static bool load_prog(HiRegex *rx, Prog *pg, bool reversed, int npatterns, HiImageReader *r) {
+	pg->ninst    = r->get_int();
+	pg->start    = r->get_int();
+	pg->reversed = reversed;
+
+	if(r->error || pg->ninst < 1 || pg->ninst > MAX_INST || pg->start < 0 || pg->start >= pg->ninst)
+		return false;
+
+	pg->inst = new Inst[pg->ninst];
+	if(!r->get(pg->inst, sizeof(Inst) * pg->ninst))
+		return false;
+
+	for(int i = 0; i < pg->ninst; i++) {
+		Inst *in = &pg->inst[i];
+		bool ok;
+
+		switch(in->op) {
+			case OP_SET:
+				ok = in->arg >= 0 && in->arg < rx->nsets && i + 1 < pg->ninst;
+				break;
+			case OP_ASSERT:
+				ok = in->arg >= AS_BOL && in->arg <= AS_WEND && i + 1 < pg->ninst;
+				break;
+			case OP_SPLIT:
+				ok = in->x >= 0 && in->x < pg->ninst && in->y >= 0 && in->y < pg->ninst;
+				break;
+			case OP_JMP:
+				ok = in->x >= 0 && in->x < pg->ninst;
+				break;
+			case OP_MATCH:
+				ok = in->arg >= 0 && in->arg < npatterns;
+				break;
+			default:
+				ok = false;
+				break;
+		}
+
+		if(!ok) return false;
+	}
+
+	return true;
+}
+
+void hi_regex_save(const HiRegex *rx, HiImageWriter *w) {
+	w->put_int(rx->flags);
+	w->put_int(rx->nsets);
+	w->put(rx->sets, sizeof(unsigned int) * SET_WORDS * rx->nsets);
+
+	w->put_int(rx->nclasses);
+	w->put(rx->classes, sizeof(rx->classes));
+	w->put(rx->class_rep, sizeof(rx->class_rep));
+	w->put(rx->class_type, sizeof(rx->class_type));
+
+	save_prog(&rx->fwd, w);
+	save_prog(&rx->rev, w);
+}
+
+HiRegex *hi_regex_load(HiImageReader *r, int npatterns) {
+	HiRegex *rx = new HiRegex;
+	memset(rx, 0, sizeof(HiRegex));
+
+	rx->flags = r->get_int();
+	rx->nsets = r->get_int();
+	bool ok = !r->error && rx->nsets >= 0 && rx->nsets <= MAX_INST;
+
+	if(ok && rx->nsets) {
+		rx->sets_size = rx->nsets;
+		rx->sets = new unsigned int[rx->nsets * SET_WORDS];
+		ok = r->get(rx->sets, sizeof(unsigned int) * SET_WORDS * rx->nsets);
+	}
+
+	rx->nclasses = r->get_int();
+	ok = ok && r->get(rx->classes, sizeof(rx->classes)) &&
+		 r->get(rx->class_rep, sizeof(rx->class_rep)) &&
+		 r->get(rx->class_type, sizeof(rx->class_type)) &&
+		 rx->nclasses >= 1 && rx->nclasses <= 256;
+
+	for(int c = 0; ok && c < 256; c++)
+		ok = rx->classes[c] < rx->nclasses;
+	for(int c = 0; ok && c <= rx->nclasses; c++)
+		ok = rx->class_type[c] <= T_OTHER;
+
+	/* scratch arrays are sized by forward program, so both must be the same size, like compiled ones are */
+	ok = ok && load_prog(rx, &rx->fwd, false, npatterns, r) && load_prog(rx, &rx->rev, true, npatterns, r) &&
+		 rx->fwd.ninst == rx->rev.ninst;
+
+	if(!ok) {
+		hi_regex_free(rx);
+		return NULL;
+	}
+
+	init_matching(rx);
+	return rx;
+}
+
+void hi_regex_free(HiRegex *rx) {
+	if(!rx) return;
+
+	dfa_free(&rx->longest);
+	dfa_free(&rx->search);
+	dfa_free(&rx->starts);
+
+	delete [] rx->nodes;
+	delete [] rx->sets;
+	delete [] rx->fwd.inst;
+	delete [] rx->rev.inst;
+	delete [] rx->stack;
+	delete [] rx->mark;
+	delete [] rx->list;
+	delete [] rx->bits;
+	delete rx;
+}
+
+bool hi_regex_test(HiRegex *rx, const char *text, int len) {
+	DFA *d = &rx->search;
+	int s = dfa_start(rx, d, T_BOUND), acc = 0;
+
+	for(int i = 0; i < len; i++) {
+		DFA_NEXT(rx, d, s, rx->classes[(unsigned char)text[i]], acc);
+		if(acc) return true;
+	}
+
+	DFA_NEXT(rx, d, s, rx->nclasses, acc);
+	return acc != 0;
+}
+
+int hi_regex_match_at(HiRegex *rx, const char *text, int len, int pos) {
+	int tag;
+	return dfa_longest(rx, text, len, pos, &tag);
+}
+
+bool hi_regex_search(HiRegex *rx, const char *text, int len, int from, int *mstart, int *mend) {
+	dfa_mark_starts(rx, text, len, from);
+
+	int s = next_start(rx, from, len);
+	if(s == -1) return false;
+
+	int tag;
+	*mstart = s;
+	*mend   = dfa_longest(rx, text, len, s, &tag);
+	return true;
+}
+
+long hi_regex_memory(HiRegex *rx) {
+	return sizeof(HiRegex) + (long)(rx->fwd.ninst + rx->rev.ninst) * sizeof(Inst) +
+		   (long)rx->nsets * SET_WORDS * sizeof(int) + (long)rx->bits_size * sizeof(int) +
+		   dfa_memory(rx, &rx->longest) + dfa_memory(rx, &rx->search) + dfa_memory(rx, &rx->starts);
+}
+
+void hi_regex_scan_begin(HiRegexScan *scan, HiRegex *rx, const char *text, int len) {
+	scan->rx   = rx;
+	scan->text = text;
+	scan->len  = len;
+	scan->pos  = 0;
+	scan->tag  = -1;
+
+	dfa_mark_starts(rx, text, len, 0);
+}
+
+bool hi_regex_scan_next(HiRegexScan *scan, int *mstart, int *mend) {
+	if(scan->pos > scan->len) return false;
+
+	int s = next_start(scan->rx, scan->pos, scan->len);
+	if(s == -1) {
+		scan->pos = scan->len + 1;
+		return false;
+	}
+
+	*mstart = s;
+	*mend   = dfa_longest(scan->rx, scan->text, scan->len, s, &scan->tag);
+
+	/* empty match; move forward or we will loop forever */
+	scan->pos = (*mend > s) ? *mend : s + 1;
+	return true;
+}
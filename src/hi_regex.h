@@ -0,0 +1,114 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_REGEX_H
+#define HI_REGEX_H
+
+/*
+ * Builtin regex engine for highlighting. Patterns are POSIX extended regular expressions with GNU extensions
+ * (\w \W \s \S \b \B \< \> \` \'); everything except backreferences is supported. Matching is leftmost-longest,
+ * like regexec(), and is done with DFA built lazily from compiled program, with bounded memory and no backtracking.
+ * Every match attempt is linear to the text it looks at; finding all matches runs one such pass from each match
+ * start, so a line can take quadratic time in the worst case.
+ *
+ * With HI_REGEX_NEWLINE, no expression will match newline character, so matches never cross line boundaries.
+ */
+
+enum {
+	HI_REGEX_ICASE   = (1 << 0),
+	HI_REGEX_NEWLINE = (1 << 1)
+};
+
+struct HiRegex;
+struct HiImageWriter;
+struct HiImageReader;
+
+/* compile pattern; returns NULL if pattern is invalid or uses something this engine does not support */
+HiRegex *hi_regex_compile(const char *pattern, int flags);
+
+/*
+ * Compile patterns into single automaton, matching any of them. Every match is tagged with index of the pattern it
+ * came from (see HiRegexScan::tag); if more patterns match the same text, the one with the highest index wins.
+ * Returns NULL if any pattern is not supported.
+ */
+HiRegex *hi_regex_compile_set(const char **patterns, int npatterns, int flags);
+void     hi_regex_free(HiRegex *rx);
+
+/* copy of compiled pattern with its own DFA cache, so it can be used by another thread */
+HiRegex *hi_regex_clone(const HiRegex *rx);
+
+/* write compiled program into image; DFA states built so far are not written, as they are built again lazily */
+void     hi_regex_save(const HiRegex *rx, HiImageWriter *w);
+
+/* read program of 'npatterns' patterns written by hi_regex_save(); returns NULL if image is damaged */
+HiRegex *hi_regex_load(HiImageReader *r, int npatterns);
+
+/* the most literals hi_regex_literals() finds */
+#define HI_REGEX_MAX_LITERALS 8
+
+/*
+ * Find literals one of which every match of pattern contains, so text without any of them can be skipped. Fills
+ * 'lits' with malloc()-ed strings and 'lens' with their lengths and returns their number, or 0 if there are no such
+ * literals (or pattern uses \` or \', which depend on where text ends). Backreferences are accepted, as any text.
+ */
+int      hi_regex_literals(const char *pattern, int flags, char **lits, int *lens);
+
+/*
+ * Returns true if every match of pattern starts at the beginning of a line ('^' with HI_REGEX_NEWLINE), so it has to
+ * be tried only there. Backreferences are accepted, as any text.
+ */
+bool     hi_regex_line_anchored(const char *pattern, int flags);
+
+/* escape 'str' so it is matched literally; returned value is malloc()-ed */
+char    *hi_regex_quote(const char *str);
+
+/* returns true if pattern matches anywhere inside text */
+bool     hi_regex_test(HiRegex *rx, const char *text, int len);
+
+/*
+ * Find leftmost-longest match starting at or after 'from'. Characters before 'from' are used only as context for
+ * anchors and word boundaries. For repeated searches over the same text, use HiRegexScan.
+ */
+bool     hi_regex_search(HiRegex *rx, const char *text, int len, int from, int *mstart, int *mend);
+
+/*
+ * Longest match starting exactly at 'pos'; returns its end, or -1 if there is none. Characters before 'pos' are used
+ * only as context for anchors and word boundaries.
+ */
+int      hi_regex_match_at(HiRegex *rx, const char *text, int len, int pos);
+
+/* memory used by compiled program and DFA states built so far */
+long     hi_regex_memory(HiRegex *rx);
+
+/*
+ * Iterate over all non-overlapping leftmost-longest matches in text, the same way regexec() is called again after
+ * the end of previous match. Possible match starts are found in one backward pass over the text at
+ * hi_regex_scan_begin(), so every hi_regex_scan_next() only runs forward from the next start. 'pos' can be moved
+ * forward between calls to skip part of the text.
+ */
+struct HiRegexScan {
+	HiRegex    *rx;
+	const char *text;
+	int         len, pos;
+	int         tag; /* pattern index of the last match */
+};
+
+void hi_regex_scan_begin(HiRegexScan *scan, HiRegex *rx, const char *text, int len);
+bool hi_regex_scan_next(HiRegexScan *scan, int *mstart, int *mend);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "hi_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# include <immintrin.h>
+# define HI_SCAN_X86 1
+#else
+# define HI_SCAN_X86 0
+#endif
+
+HiByteSet::HiByteSet() {
+	clear();
+}
+
+void HiByteSet::clear(void) {
+	nbytes = 0;
+	memset(has, 0, sizeof(has));
+}
+
+void HiByteSet::add(unsigned char c) {
+	if(has[c]) return;
+
+	has[c] = true;
+	if(nbytes < 0) return;
+
+	if(nbytes < HI_SCAN_MAX_BYTES)
+		bytes[nbytes++] = c;
+	else
+		nbytes = -1;
+}
+
+/* plain C versions; also used for what is left after the last full vector */
+
+static int count_lines_scalar(const char *text, int len) {
+	int n = 0;
+
+	for(int i = 0; i < len; i++)
+		n += (text[i] == '\n');
+
+	return n;
+}
+
+static int bytes_scalar(const HiByteSet *set, const char *text, int len) {
+	for(int i = 0; i < len; i++) {
+		if(set->has[(unsigned char)text[i]])
+			return i;
+	}
+
+	return len;
+}
+
+#if HI_SCAN_X86
+/*
+ * Matches are counted per byte lane (cmpeq gives -1, so subtracting counts up) and lanes are summed with sad before
+ * they can overflow; this avoids popcnt, which SSE2 processors may not have.
+ */
+__attribute__((target("sse2")))
+static int count_lines_sse2(const char *text, int len) {
+	__m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128(), sum = zero;
+	int i = 0;
+
+	while(i + 16 <= len) {
+		__m128i acc = zero;
+
+		for(int k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+		}
+
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, zero));
+	}
+
+	return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum)) +
+		count_lines_scalar(text + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static int bytes_sse2(const HiByteSet *set, const char *text, int len) {
+	if(set->nbytes < 0) return bytes_scalar(set, text, len);
+
+	__m128i b[HI_SCAN_MAX_BYTES];
+	int i = 0, k, n = set->nbytes;
+
+	for(k = 0; k < n; k++)
+		b[k] = _mm_set1_epi8((char)set->bytes[k]);
+
+	for(; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(text + i)), m = _mm_setzero_si128();
+
+		for(k = 0; k < n; k++)
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, b[k]));
+
+		int mask = _mm_movemask_epi8(m);
+		if(mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + bytes_scalar(set, text + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int count_lines_avx2(const char *text, int len) {
+	__m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256(), sum = zero;
+	int i = 0;
+
+	while(i + 32 <= len) {
+		__m256i acc = zero;
+
+		for(int k = 0; k < 255 && i + 32 <= len; k++, i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+		}
+
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, zero));
+	}
+
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	return _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(s, s)) +
+		count_lines_scalar(text + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int bytes_avx2(const HiByteSet *set, const char *text, int len) {
+	if(set->nbytes < 0) return bytes_scalar(set, text, len);
+
+	__m256i b[HI_SCAN_MAX_BYTES];
+	int i = 0, k, n = set->nbytes;
+
+	for(k = 0; k < n; k++)
+		b[k] = _mm256_set1_epi8((char)set->bytes[k]);
+
+	for(; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(text + i)), m = _mm256_setzero_si256();
+
+		for(k = 0; k < n; k++)
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, b[k]));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+		if(mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + bytes_scalar(set, text + i, len - i);
+}
+#endif
+
+static HiScanKernel kernels[3];
+static int nkernels;
+
+/* fill kernels once; every thread doing it at the same time writes the same values */
+static void init_kernels(void) {
+	HiScanKernel k[3];
+	int n = 0;
+
+#if HI_SCAN_X86
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2")) {
+		k[n].name        = "avx2";
+		k[n].count_lines = count_lines_avx2;
+		k[n].bytes       = bytes_avx2;
+		n++;
+	}
+
+	if(__builtin_cpu_supports("sse2")) {
+		k[n].name        = "sse2";
+		k[n].count_lines = count_lines_sse2;
+		k[n].bytes       = bytes_sse2;
+		n++;
+	}
+#endif
+
+	k[n].name        = "scalar";
+	k[n].count_lines = count_lines_scalar;
+	k[n].bytes       = bytes_scalar;
+	n++;
+
+	memcpy(kernels, k, sizeof(k));
+	__sync_synchronize();
+	nkernels = n;
+}
+
+static int count_lines_init(const char *text, int len);
+static int bytes_init(const HiByteSet *set, const char *text, int len);
+
+/* the first call of every function picks the kernel */
+static int (*count_lines_fn)(const char*, int) = count_lines_init;
+static int (*bytes_fn)(const HiByteSet*, const char*, int) = bytes_init;
+
+static int count_lines_init(const char *text, int len) {
+	if(!nkernels) init_kernels();
+	count_lines_fn = kernels[0].count_lines;
+	return count_lines_fn(text, len);
+}
+
+static int bytes_init(const HiByteSet *set, const char *text, int len) {
+	if(!nkernels) init_kernels();
+	bytes_fn = kernels[0].bytes;
+	return bytes_fn(set, text, len);
+}
+
+int hi_scan_count_lines(const char *text, int len) {
+	return count_lines_fn(text, len);
+}
+
+int hi_scan_bytes(const HiByteSet *set, const char *text, int len) {
+	/* libc memchr() is unrolled further than the kernels and wins on a single byte (see test/bench_scan) */
+	if(set->nbytes == 1) {
+		const char *p = (const char*)memchr(text, set->bytes[0], len);
+		return p ? p - text : len;
+	}
+
+	return bytes_fn(set, text, len);
+}
+
+int hi_scan_kernels(const HiScanKernel **ret) {
+	if(!nkernels) init_kernels();
+	*ret = kernels;
+	return nkernels;
+}
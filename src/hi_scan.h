@@ -0,0 +1,58 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_SCAN_H
+#define HI_SCAN_H
+
+/*
+ * Byte scanning kernels used while highlighting: counting lines and finding the next byte that can start a token.
+ * On x86, SSE2 and AVX2 versions are compiled in and the best one the processor supports is chosen on the first
+ * call; everywhere else (or if the processor has neither), plain C version is used.
+ */
+
+/* the most bytes HiByteSet searches with vector compares; larger sets are searched with lookup table */
+#define HI_SCAN_MAX_BYTES 8
+
+struct HiByteSet {
+	unsigned char bytes[HI_SCAN_MAX_BYTES];
+	int           nbytes;    /* -1 if there are more than HI_SCAN_MAX_BYTES */
+	bool          has[256];
+
+	HiByteSet();
+
+	void clear(void);
+	void add(unsigned char c);
+};
+
+/* number of newlines in text */
+int hi_scan_count_lines(const char *text, int len);
+
+/* position of the first byte from 'set', or 'len' if there is none */
+int hi_scan_bytes(const HiByteSet *set, const char *text, int len);
+
+/* one implementation of the kernels */
+struct HiScanKernel {
+	const char *name;
+	int (*count_lines)(const char *text, int len);
+	int (*bytes)(const HiByteSet *set, const char *text, int len);
+};
+
+/* kernels this processor can run, the best one (used by functions above) first; for benchmarks */
+int hi_scan_kernels(const HiScanKernel **kernels);
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "hi_style.h"
+
+HiStyleRuns::HiStyleRuns() {
+	blocks  = NULL;
+	nblocks = blocks_size = 0;
+	length  = 0;
+	hint_block = hint_pos = 0;
+	tmp_len   = NULL;
+	tmp_style = NULL;
+	tmp_size  = 0;
+}
+
+HiStyleRuns::~HiStyleRuns() {
+	clear();
+	delete [] blocks;
+	delete [] tmp_len;
+	delete [] tmp_style;
+}
+
+void HiStyleRuns::clear(void) {
+	for(int i = 0; i < nblocks; i++)
+		delete blocks[i];
+
+	nblocks = 0;
+	length  = 0;
+	hint_block = hint_pos = 0;
+}
+
+/* block containing 'pos' and its start; for the position at the end of the text, the last block */
+int HiStyleRuns::find(int pos, int *block_pos) {
+	int b = hint_block, bp = hint_pos;
+
+	if(b >= nblocks) b = bp = 0;
+
+	while(bp > pos && b > 0) {
+		b--;
+		bp -= blocks[b]->length;
+	}
+
+	while(b < nblocks - 1 && bp + blocks[b]->length <= pos) {
+		bp += blocks[b]->length;
+		b++;
+	}
+
+	hint_block = b;
+	hint_pos   = bp;
+	*block_pos = bp;
+	return b;
+}
+
+/* append run to temporary runs, merging it with the previous one if it has the same style */
+void HiStyleRuns::push_run(int *n, int len, char style) {
+	if(len <= 0) return;
+
+	if(*n > 0 && tmp_style[*n - 1] == style) {
+		tmp_len[*n - 1] += len;
+		return;
+	}
+
+	if(*n >= tmp_size) {
+		int   sz = tmp_size ? tmp_size * 2 : HI_STYLE_BLOCK_RUNS * 4;
+		int  *l  = new int[sz];
+		char *s  = new char[sz];
+
+		if(*n) {
+			memcpy(l, tmp_len, sizeof(int) * *n);
+			memcpy(s, tmp_style, *n);
+		}
+
+		delete [] tmp_len;
+		delete [] tmp_style;
+		tmp_len   = l;
+		tmp_style = s;
+		tmp_size  = sz;
+	}
+
+	tmp_len[*n]   = len;
+	tmp_style[*n] = style;
+	(*n)++;
+}
+
+/*
+ * Collect runs of blocks touched by the edit with edit applied, and store them back into as many full blocks as
+ * needed. Block objects of the old blocks are reused.
+ */
+void HiStyleRuns::splice(int pos, int ndeleted, const char *styles, char style, int ninserted) {
+	int first = 0, last = -1, first_pos = 0, last_end = 0, n = 0, i, j, p;
+
+	if(nblocks) {
+		first    = find(pos, &first_pos);
+		last     = first;
+		last_end = first_pos + blocks[first]->length;
+
+		while(last_end < pos + ndeleted && last < nblocks - 1)
+			last_end += blocks[++last]->length;
+	}
+
+	/* runs before the edit */
+	for(i = first, p = first_pos; i <= last && p < pos; i++) {
+		for(j = 0; j < blocks[i]->nruns && p < pos; j++) {
+			push_run(&n, (p + blocks[i]->len[j] <= pos) ? blocks[i]->len[j] : pos - p, blocks[i]->style[j]);
+			p += blocks[i]->len[j];
+		}
+	}
+
+	/* inserted styles */
+	if(styles) {
+		for(i = 0; i < ninserted; i = j) {
+			for(j = i + 1; j < ninserted && styles[j] == styles[i]; j++)
+				;
+			push_run(&n, j - i, styles[i]);
+		}
+	} else {
+		push_run(&n, ninserted, style);
+	}
+
+	/* small blocks are merged with the next one, so edits don't leave many of them */
+	if(last >= 0 && last < nblocks - 1 && blocks[first]->nruns + blocks[last + 1]->nruns < HI_STYLE_BLOCK_RUNS)
+		last_end += blocks[++last]->length;
+
+	/* runs after deleted region */
+	int from = pos + ndeleted;
+	for(i = first, p = first_pos; i <= last; i++) {
+		for(j = 0; j < blocks[i]->nruns; j++) {
+			int e = p + blocks[i]->len[j];
+			if(e > from)
+				push_run(&n, (p >= from) ? blocks[i]->len[j] : e - from, blocks[i]->style[j]);
+			p = e;
+		}
+	}
+
+	/* replace old blocks with new ones */
+	int nold = last - first + 1, nnew = (n + HI_STYLE_BLOCK_RUNS - 1) / HI_STYLE_BLOCK_RUNS;
+
+	if(nblocks - nold + nnew > blocks_size) {
+		blocks_size = (nblocks - nold + nnew) * 2;
+		HiStyleBlock **b = new HiStyleBlock*[blocks_size];
+		if(nblocks) memcpy(b, blocks, sizeof(HiStyleBlock*) * nblocks);
+		delete [] blocks;
+		blocks = b;
+	}
+
+	for(i = nnew; i < nold; i++)
+		delete blocks[first + i];
+
+	if(nnew != nold && last + 1 < nblocks)
+		memmove(blocks + first + nnew, blocks + last + 1, sizeof(HiStyleBlock*) * (nblocks - last - 1));
+
+	for(i = nold; i < nnew; i++)
+		blocks[first + i] = new HiStyleBlock;
+
+	for(i = 0, j = 0; i < nnew; i++) {
+		HiStyleBlock *b = blocks[first + i];
+		b->nruns  = (n - j < HI_STYLE_BLOCK_RUNS) ? n - j : HI_STYLE_BLOCK_RUNS;
+		b->length = 0;
+
+		memcpy(b->len, tmp_len + j, sizeof(int) * b->nruns);
+		memcpy(b->style, tmp_style + j, b->nruns);
+
+		for(p = 0; p < b->nruns; p++)
+			b->length += b->len[p];
+		j += b->nruns;
+	}
+
+	nblocks += nnew - nold;
+	length  += ninserted - ndeleted;
+
+	/* don't keep what was needed for restyling large part of text */
+	if(tmp_size > HI_STYLE_BLOCK_RUNS * 64) {
+		delete [] tmp_len;
+		delete [] tmp_style;
+		tmp_len   = NULL;
+		tmp_style = NULL;
+		tmp_size  = 0;
+	}
+
+	/* blocks before the edit didn't change */
+	hint_block = first;
+	hint_pos   = first_pos;
+}
+
+char HiStyleRuns::at(int pos) {
+	if(pos < 0 || pos >= length) return 0;
+
+	int bp, b = find(pos, &bp);
+	HiStyleBlock *blk = blocks[b];
+
+	for(int i = 0; i < blk->nruns; i++) {
+		bp += blk->len[i];
+		if(pos < bp) return blk->style[i];
+	}
+
+	return 0;
+}
+
+void HiStyleRuns::get(int pos, int len, char *out) {
+	if(len <= 0 || pos >= length) return;
+
+	int bp, b = find(pos, &bp), i = 0, n;
+
+	/* skip runs before 'pos' */
+	while(bp + blocks[b]->len[i] <= pos)
+		bp += blocks[b]->len[i++];
+
+	for(; len > 0 && b < nblocks; b++, i = 0) {
+		for(; len > 0 && i < blocks[b]->nruns; i++) {
+			n = bp + blocks[b]->len[i] - pos;
+			if(n > len) n = len;
+
+			memset(out, blocks[b]->style[i], n);
+			out += n;
+			pos += n;
+			len -= n;
+			bp  += blocks[b]->len[i];
+		}
+	}
+}
+
+int HiStyleRuns::diff(int pos, int len, const char *style, HiRanges *out) {
+	if(len <= 0 || pos >= length) return 0;
+
+	int bp, b = find(pos, &bp), i = 0, k = 0, e, from = -1, n = 0;
+	char c;
+
+	while(bp + blocks[b]->len[i] <= pos)
+		bp += blocks[b]->len[i++];
+
+	/* 'k' is offset in 'style', 'e' is the end of the current run relative to 'pos' */
+	for(; k < len && b < nblocks; b++, i = 0) {
+		for(; k < len && i < blocks[b]->nruns; i++) {
+			e = bp + blocks[b]->len[i] - pos;
+			if(e > len) e = len;
+			c = blocks[b]->style[i];
+
+			for(; k < e; k++) {
+				if(style[k] != c) {
+					if(from < 0) from = k;
+					n++;
+				} else if(from >= 0) {
+					out->add(pos + from, pos + k);
+					from = -1;
+				}
+			}
+
+			bp += blocks[b]->len[i];
+		}
+	}
+
+	if(from >= 0) out->add(pos + from, pos + k);
+	return n;
+}
+
+int HiStyleRuns::runs(void) const {
+	int n = 0;
+	for(int i = 0; i < nblocks; i++)
+		n += blocks[i]->nruns;
+	return n;
+}
+
+long HiStyleRuns::memory(void) const {
+	return sizeof(HiStyleRuns) + (long)nblocks * sizeof(HiStyleBlock) + (long)blocks_size * sizeof(HiStyleBlock*) +
+		   (long)tmp_size * (sizeof(int) + 1);
+}
+
+HiRanges::HiRanges() {
+	start = end = NULL;
+	n = size = 0;
+}
+
+HiRanges::~HiRanges() {
+	delete [] start;
+	delete [] end;
+}
+
+void HiRanges::add(int s, int e) {
+	if(s >= e) return;
+
+	int i, j;
+
+	if(n > 0 && s > end[n - 1]) {
+		/* ranges are mostly added in order */
+		i = j = n;
+	} else {
+		/* first range ending at or after 's' and the first one starting after 'e' */
+		for(i = 0; i < n && end[i] < s; i++)
+			;
+		for(j = i; j < n && start[j] <= e; j++)
+			;
+	}
+
+	if(i < j) {
+		/* merge ranges i .. j-1 into one */
+		if(start[i] < s) s = start[i];
+		if(end[j - 1] > e) e = end[j - 1];
+
+		start[i] = s;
+		end[i]   = e;
+
+		if(j - i > 1) {
+			memmove(start + i + 1, start + j, sizeof(int) * (n - j));
+			memmove(end + i + 1, end + j, sizeof(int) * (n - j));
+			n -= j - i - 1;
+		}
+		return;
+	}
+
+	if(n >= size) {
+		int  sz = size ? size * 2 : 16;
+		int *ns = new int[sz], *ne = new int[sz];
+
+		if(n) {
+			memcpy(ns, start, sizeof(int) * n);
+			memcpy(ne, end, sizeof(int) * n);
+		}
+
+		delete [] start;
+		delete [] end;
+		start = ns;
+		end   = ne;
+		size  = sz;
+	}
+
+	memmove(start + i + 1, start + i, sizeof(int) * (n - i));
+	memmove(end + i + 1, end + i, sizeof(int) * (n - i));
+	start[i] = s;
+	end[i]   = e;
+	n++;
+}
+
+void HiRanges::remove(int s, int e) {
+	if(s >= e) return;
+
+	for(int i = 0; i < n; i++) {
+		if(end[i] <= s || start[i] >= e) continue;
+
+		if(start[i] < s && end[i] > e) {
+			/* split in two */
+			int old_end = end[i];
+			end[i] = s;
+			add(e, old_end);
+			return;
+		}
+
+		if(start[i] < s)
+			end[i] = s;
+		else if(end[i] > e)
+			start[i] = e;
+		else {
+			memmove(start + i, start + i + 1, sizeof(int) * (n - i - 1));
+			memmove(end + i, end + i + 1, sizeof(int) * (n - i - 1));
+			n--;
+			i--;
+		}
+	}
+}
+
+void HiRanges::shift(int pos, int ndeleted, int ninserted) {
+	int i, j, d = ninserted - ndeleted;
+
+	for(i = 0, j = 0; i < n; i++) {
+		int s = start[i], e = end[i];
+
+		if(s >= pos + ndeleted)  s += d;
+		else if(s > pos)         s = pos;
+
+		if(e >= pos + ndeleted)  e += d;
+		else if(e > pos)         e = pos;
+
+		if(s >= e) continue;
+
+		/* ranges around deleted text could touch now */
+		if(j > 0 && end[j - 1] >= s) {
+			if(e > end[j - 1]) end[j - 1] = e;
+			continue;
+		}
+
+		start[j] = s;
+		end[j]   = e;
+		j++;
+	}
+
+	n = j;
+}
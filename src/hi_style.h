@@ -0,0 +1,97 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_STYLE_H
+#define HI_STYLE_H
+
+#define HI_STYLE_BLOCK_RUNS 128
+
+struct HiRanges;
+
+struct HiStyleBlock {
+	int  length;                     /* characters covered by this block */
+	int  nruns;
+	int  len[HI_STYLE_BLOCK_RUNS];
+	char style[HI_STYLE_BLOCK_RUNS];
+};
+
+/*
+ * Style character of every text character, stored as runs of the same style. Runs are grouped in blocks of up to
+ * HI_STYLE_BLOCK_RUNS, so an edit rebuilds only blocks it touches and position is found by skipping whole blocks.
+ */
+struct HiStyleRuns {
+	HiStyleBlock **blocks;
+	int nblocks, blocks_size;
+	int length;
+
+	/* the last found block and its start position; lookups are usually close to each other */
+	int hint_block, hint_pos;
+
+	/* runs of the rebuilt region, reused between edits */
+	int  *tmp_len;
+	char *tmp_style;
+	int   tmp_size;
+
+	HiStyleRuns();
+	~HiStyleRuns();
+
+	void clear(void);
+
+	/* replace 'ndeleted' styles at 'pos' with 'ninserted' ones from 'styles' */
+	void replace(int pos, int ndeleted, const char *styles, int ninserted) { splice(pos, ndeleted, styles, 0, ninserted); }
+
+	/* the same as replace(), but all inserted characters get 'style' */
+	void fill(int pos, int ndeleted, char style, int ninserted) { splice(pos, ndeleted, 0, style, ninserted); }
+
+	char at(int pos);
+
+	/* copy styles of 'len' characters from 'pos' to 'out' */
+	void get(int pos, int len, char *out);
+
+	/* add spans where 'len' styles from 'style' differ from those at 'pos' to 'out'; returns the number of differences */
+	int  diff(int pos, int len, const char *style, HiRanges *out);
+
+	int  runs(void) const;
+	long memory(void) const;
+
+private:
+	int  find(int pos, int *block_pos);
+	void push_run(int *n, int len, char style);
+	void splice(int pos, int ndeleted, const char *styles, char style, int ninserted);
+};
+
+/* sorted set of non-overlapping [start, end) ranges of text positions */
+struct HiRanges {
+	int *start, *end;
+	int  n, size;
+
+	HiRanges();
+	~HiRanges();
+
+	void clear(void) { n = 0; }
+	bool empty(void) const { return n == 0; }
+
+	/* add range; it is merged with ranges it overlaps or touches */
+	void add(int s, int e);
+	void remove(int s, int e);
+
+	/* move ranges after text edit at 'pos'; what was inside deleted text collapses to 'pos' */
+	void shift(int pos, int ndeleted, int ninserted);
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "hi_tokens.h"
+
+#define IS_DIGIT(c)  ((c) >= '0' && (c) <= '9')
+#define IS_XDIGIT(c) (IS_DIGIT(c) || ((c) >= 'a' && (c) <= 'f') || ((c) >= 'A' && (c) <= 'F'))
+
+int hi_token_string(const char *text, int from, int len, const char *delim, int dlen, int escape, bool line,
+					bool *open)
+{
+	const unsigned char *t = (const unsigned char*)text;
+	int d = (unsigned char)delim[0];
+
+	/* content at region start continues string from previous line */
+	bool continued = (from == 0);
+
+	*open = false;
+
+	for(int i = from; i < len; i++) {
+		int c = t[i];
+
+		if(c == d) {
+			if(c == escape && i + dlen * 2 <= len && memcmp(text + i + dlen, delim, dlen) == 0) {
+				i += dlen * 2 - 1;
+				continue;
+			}
+
+			if(i + dlen <= len && (dlen == 1 || memcmp(text + i, delim, dlen) == 0))
+				return i + dlen;
+		} else if(c == escape) {
+			/* escaped newline continues the line string too */
+			if(i + 1 < len && t[i + 1] == '\n') continued = true;
+			i++;
+		} else if(c == '\n' && line) {
+			return continued ? i : -1;
+		}
+	}
+
+	*open = true;
+	return len;
+}
+
+int hi_token_number(const char *text, int pos, int len, const bool *word) {
+	const unsigned char *t = (const unsigned char*)text;
+	int i = pos, j;
+
+	if(i + 1 < len && t[i] == '0' && (t[i + 1] == 'x' || t[i + 1] == 'X')) {
+		for(i += 2; i < len && (IS_XDIGIT(t[i]) || t[i] == '_'); i++)
+			;
+	} else {
+		while(i < len && (IS_DIGIT(t[i]) || t[i] == '_'))
+			i++;
+
+		if(i < len && t[i] == '.') {
+			for(i++; i < len && (IS_DIGIT(t[i]) || t[i] == '_'); i++)
+				;
+		}
+
+		/* exponent only if digits follow, so '1e' is number '1' with suffix 'e' */
+		if(i < len && (t[i] == 'e' || t[i] == 'E')) {
+			j = i + 1;
+			if(j < len && (t[j] == '+' || t[j] == '-')) j++;
+
+			if(j < len && IS_DIGIT(t[j])) {
+				for(i = j; i < len && IS_DIGIT(t[i]); i++)
+					;
+			}
+		}
+	}
+
+	/* suffixes */
+	while(i < len && word[t[i]])
+		i++;
+
+	return i;
+}
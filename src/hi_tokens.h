@@ -0,0 +1,43 @@
+/*
+ * Fl_Highlight_Editor - extensible text editing widget
+ * Copyright (c) 2013-2014 Sanel Zukan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HI_TOKENS_H
+#define HI_TOKENS_H
+
+/*
+ * Lexer primitives for string, number and identifier contexts, doing what regex like "([^"]|\\")*" would, but in
+ * single pass and with state regex doesn't have (string still open at the end of the line).
+ */
+
+/*
+ * End of the string whose content starts at 'from': position after closing 'delim' ('dlen' bytes), or 'len' with
+ * 'open' set if text ended first. Byte after 'escape' (-1 for none) never closes the string; if 'escape' is the first
+ * byte of 'delim', doubled delimiter is escaped ('' in SQL). With 'line', newline not escaped ends the string before
+ * it was closed: -1 is returned if string started on that line, so it is not painted at all, and newline position if
+ * it came from previous line (escaped newline, or 'from' is 0), so painting of every line depends only on lines above.
+ */
+int hi_token_string(const char *text, int from, int len, const char *delim, int dlen, int escape, bool line,
+					bool *open);
+
+/*
+ * End of number starting at 'pos' with a digit or '.' followed by a digit: decimal, hex (0x), float with exponent
+ * and everything glued to it, which are suffixes (10UL, 1.5f) in most languages. 'word' are bytes words are made of.
+ */
+int hi_token_number(const char *text, int pos, int len, const bool *word);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Compare builtin regex engine against POSIX regex on c-mode patterns: compile time, memory, throughput over the
+ * whole file and latency of re-matching a single line (what is done on every keystroke). Throughput of all patterns
+ * compiled into single automaton is shown too.
+ *
+ * Usage: bench [file] [iterations]
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "src/hi_regex.h"
+
+static const char *patterns[] = {
+	"\\<(auto|break|case|continue|default|do|else|enum|extern|for|goto|if|return|sizeof|static|switch|typedef|union|struct|while)\\>",
+	"(bool|char|const|double|float|int|long|register|short|signed|unsigned|void|volatile|va_list)\\s+",
+	"^\\s*#\\s*\\w+",
+	"^\\s*#\\s*<?.*>",
+	"\"([^\"]|\\\\\"|\\\\)*\"",
+	"'(.|\\\\')'",
+	"(FIXME|TODO|XXX):"
+};
+
+#define NPATTERNS (int)(sizeof(patterns) / sizeof(patterns[0]))
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long heap_used(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return (long)mallinfo2().uordblks;
+#else
+	return (long)mallinfo().uordblks;
+#endif
+}
+
+static char *load_file(const char *path, int *len) {
+	FILE *f = fopen(path, "rb");
+	if(!f) return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = (char*)malloc(*len + 1);
+	*len = fread(buf, 1, *len, f);
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/* the same line by line loop hi_parse() does with POSIX regex; returns number of matched characters */
+static long posix_scan(regex_t *rx, char *text, int len) {
+	regmatch_t m[1];
+	char *line, *le, *str, *end = text + len, saved;
+	long n = 0;
+
+	for(line = text; line <= end; line = le + 1) {
+		le = (char*)memchr(line, '\n', end - line);
+		if(!le) le = end;
+
+		saved = *le;
+		*le = '\0';
+
+		for(str = line; str <= le && regexec(rx, str, 1, m, (str == line) ? 0 : REG_NOTBOL) != REG_NOMATCH; str += m[0].rm_eo) {
+			n += m[0].rm_eo - m[0].rm_so;
+			if(m[0].rm_eo == 0) str++;
+		}
+
+		*le = saved;
+	}
+
+	return n;
+}
+
+static long dfa_scan(HiRegex *rx, const char *text, int len) {
+	HiRegexScan scan;
+	int s, e;
+	long n = 0;
+
+	hi_regex_scan_begin(&scan, rx, text, len);
+	while(hi_regex_scan_next(&scan, &s, &e))
+		n += e - s;
+
+	return n;
+}
+
+int main(int argc, char **argv) {
+	const char *path = (argc > 1) ? argv[1] : "src/Fl_Highlight_Editor.cxx";
+	int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+	int len, i, j, nlines;
+	double t, posix_time, dfa_time;
+	long heap, posix_mem, dfa_mem, posix_n, dfa_n;
+
+	char *text = load_file(path, &len);
+	if(!text) {
+		printf("Unable to load %s\n", path);
+		return 1;
+	}
+
+	regex_t  posix[NPATTERNS];
+	HiRegex *dfa[NPATTERNS];
+
+	/* compile */
+	heap = heap_used();
+	t = now();
+	for(i = 0; i < NPATTERNS; i++) {
+		if(regcomp(&posix[i], patterns[i], REG_EXTENDED | REG_NEWLINE) != 0) {
+			printf("regcomp() failed on '%s'\n", patterns[i]);
+			return 1;
+		}
+	}
+	posix_time = now() - t;
+	posix_mem  = heap_used() - heap;
+
+	t = now();
+	for(i = 0; i < NPATTERNS; i++) {
+		if(!(dfa[i] = hi_regex_compile(patterns[i], HI_REGEX_NEWLINE))) {
+			printf("hi_regex_compile() failed on '%s'\n", patterns[i]);
+			return 1;
+		}
+	}
+	dfa_time = now() - t;
+
+	printf("%s: %d bytes, %d patterns\n\n", path, len, NPATTERNS);
+	printf("%-28s %12s %12s\n", "", "posix", "dfa");
+	printf("%-28s %12.3f %12.3f\n", "compile (ms)", posix_time * 1e3, dfa_time * 1e3);
+
+	/* full scan; the first DFA pass also builds its states */
+	posix_n = dfa_n = 0;
+
+	t = now();
+	for(j = 0; j < iterations; j++) {
+		for(i = 0; i < NPATTERNS; i++)
+			posix_n += posix_scan(&posix[i], text, len);
+	}
+	posix_time = now() - t;
+
+	t = now();
+	for(j = 0; j < iterations; j++) {
+		for(i = 0; i < NPATTERNS; i++)
+			dfa_n += dfa_scan(dfa[i], text, len);
+	}
+	dfa_time = now() - t;
+
+	printf("%-28s %12.2f %12.2f\n", "full scan (MB/s)",
+		   (double)len * iterations / posix_time / 1e6, (double)len * iterations / dfa_time / 1e6);
+
+	/* all patterns as single automaton, like CONTEXT_ENGINE_COMBINED does */
+	HiRegex *combined = hi_regex_compile_set(patterns, NPATTERNS, HI_REGEX_NEWLINE);
+
+	t = now();
+	for(j = 0; j < iterations; j++)
+		dfa_scan(combined, text, len);
+	t = now() - t;
+
+	printf("%-28s %12s %12.2f\n", "combined scan (MB/s)", "-", (double)len * iterations / t / 1e6);
+	hi_regex_free(combined);
+
+	dfa_mem = 0;
+	for(i = 0; i < NPATTERNS; i++)
+		dfa_mem += hi_regex_memory(dfa[i]);
+
+	printf("%-28s %12ld %12ld\n", "memory (bytes)", posix_mem, dfa_mem);
+
+	/* every line alone, as it is re-highlighted after typing into it */
+	nlines = 0;
+	t = now();
+	for(char *line = text, *le; line < text + len; line = le + 1) {
+		le = (char*)memchr(line, '\n', (text + len) - line);
+		if(!le) le = text + len;
+
+		for(i = 0; i < NPATTERNS; i++)
+			posix_scan(&posix[i], line, le - line);
+		nlines++;
+	}
+	posix_time = now() - t;
+
+	t = now();
+	for(char *line = text, *le; line < text + len; line = le + 1) {
+		le = (char*)memchr(line, '\n', (text + len) - line);
+		if(!le) le = text + len;
+
+		for(i = 0; i < NPATTERNS; i++)
+			dfa_scan(dfa[i], line, le - line);
+	}
+	dfa_time = now() - t;
+
+	printf("%-28s %12.3f %12.3f\n", "line re-match (us/line)", posix_time * 1e6 / nlines, dfa_time * 1e6 / nlines);
+
+	if(posix_n != dfa_n)
+		printf("\nWarning: engines matched different amount of text (%ld vs %ld)\n", posix_n, dfa_n);
+
+	for(i = 0; i < NPATTERNS; i++) {
+		regfree(&posix[i]);
+		hi_regex_free(dfa[i]);
+	}
+
+	free(text);
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Time typing into a loaded file and count heap allocations done on every edit. The same edits are done on plain
+ * Fl_Text_Editor first, so allocations made by Fl_Text_Buffer and Fl_Text_Display themselves can be told apart from
+ * those made by highlighting. Every edit is scrolled into view, like when typing, and the number of lines redrawn
+ * because their highlighting changed is reported too.
+ *
+ * Usage: bench_edit [file] [edits]
+ */
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Editor.H>
+
+#include "FL/Fl_Highlight_Editor.H"
+
+static long allocations;
+
+#if defined(__GLIBC__)
+# define COUNT_ALLOCATIONS 1
+
+/* operator new uses malloc() too */
+extern "C" void *__libc_malloc(size_t n);
+extern "C" void *__libc_calloc(size_t n, size_t sz);
+extern "C" void *__libc_realloc(void *p, size_t n);
+
+extern "C" void *malloc(size_t n) {
+	allocations++;
+	return __libc_malloc(n);
+}
+
+extern "C" void *calloc(size_t n, size_t sz) {
+	allocations++;
+	return __libc_calloc(n, sz);
+}
+
+extern "C" void *realloc(void *p, size_t n) {
+	allocations++;
+	return __libc_realloc(p, n);
+}
+#else
+# define COUNT_ALLOCATIONS 0
+#endif
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* position of the edit 'i' of 'nedits' spread over the buffer */
+static int edit_pos(Fl_Text_Buffer *buf, int i, int nedits) {
+	return buf->line_end((int)((long)buf->length() * i / nedits));
+}
+
+/*
+ * Type a character and delete it at 'nedits' places spread over the buffer. Returns allocations per edit and sets
+ * 'ms' to time per edit.
+ */
+static double type_around(Fl_Text_Display *view, int nedits, double *ms) {
+	Fl_Text_Buffer *buf = view->buffer();
+	int  len = buf->length();
+	long n;
+	double t;
+
+	/* warm up; automatons and reused buffers grow on the first edits */
+	for(int i = 0; i < 16; i++) {
+		buf->insert(len / 2, "x");
+		buf->remove(len / 2, len / 2 + 1);
+	}
+
+	n = allocations;
+	t = now();
+
+	for(int i = 0; i < nedits; i++) {
+		int pos = edit_pos(buf, i, nedits);
+		view->insert_position(pos);
+		view->show_insert_position();
+		buf->insert(pos, "x");
+		buf->remove(pos, pos + 1);
+	}
+
+	*ms = (now() - t) * 1e3 / (nedits * 2);
+	return (double)(allocations - n) / (nedits * 2);
+}
+
+/* the same edits, not timed, printing average of lines redrawn after every one of them */
+static void print_redrawn(Fl_Highlight_Editor *editor, int nedits) {
+	Fl_Text_Buffer *buf = editor->buffer();
+
+	editor->load_script_string("(define *bench-redrawn* 0)");
+
+	for(int i = 0; i < nedits; i++) {
+		int pos = edit_pos(buf, i, nedits);
+		editor->insert_position(pos);
+		editor->show_insert_position();
+
+		buf->insert(pos, "x");
+		editor->load_script_string("(set! *bench-redrawn* (+ *bench-redrawn* (editor-redrawn-lines)))");
+		buf->remove(pos, pos + 1);
+		editor->load_script_string("(set! *bench-redrawn* (+ *bench-redrawn* (editor-redrawn-lines)))");
+	}
+
+	char cmd[128];
+	snprintf(cmd, sizeof(cmd), "(display (/ *bench-redrawn* %d.0))", nedits * 2);
+
+	printf("%-22s ", "lines redrawn per edit");
+	fflush(stdout);
+	editor->load_script_string(cmd);
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	const char *path = (argc > 1) ? argv[1] : "src/Fl_Highlight_Editor.cxx";
+	int nedits       = (argc > 2) ? atoi(argv[2]) : 1000;
+	double plain_ms, plain_allocs, ms, allocs;
+
+	Fl_Highlight_Editor *editor = new Fl_Highlight_Editor(0, 0, 400, 400);
+	editor->init_interpreter("./scheme");
+	/* highlight everything on every edit, so nothing is left for idle callback */
+	editor->load_script_string("(set! *editor-idle-highlight-budget* 0)");
+
+	Fl_Text_Buffer *plain_buf = new Fl_Text_Buffer();
+	if(plain_buf->loadfile(path) != 0) {
+		printf("Unable to load %s\n", path);
+		return 1;
+	}
+
+	Fl_Text_Editor *plain = new Fl_Text_Editor(0, 0, 400, 400);
+	plain->buffer(plain_buf);
+	plain_allocs = type_around(plain, nedits, &plain_ms);
+
+	editor->loadfile(path);
+	allocs = type_around(editor, nedits, &ms);
+
+	printf("\n%s: %d bytes, %d edits\n\n", path, editor->buffer()->length(), nedits * 2);
+	printf("%-22s %12s %14s\n", "", "time (ms)", "allocations");
+	printf("%-22s %12.4f %14.2f\n", "Fl_Text_Editor", plain_ms, plain_allocs);
+	printf("%-22s %12.4f %14.2f\n", "Fl_Highlight_Editor", ms, allocs);
+
+	if(COUNT_ALLOCATIONS)
+		printf("%-22s %12s %14.2f\n", "highlighting", "", allocs - plain_allocs);
+	else
+		puts("\n(allocations are counted only with glibc)");
+
+	printf("\n");
+	print_redrawn(editor, nedits);
+
+	delete editor;
+	delete plain;
+	delete plain_buf;
+	return 0;
+}
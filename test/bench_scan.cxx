@@ -0,0 +1,138 @@
+/*
+ * Throughput of byte scanning kernels (see src/hi_scan.h): counting lines and finding the next byte of a set, as
+ * done for literal tokens and regex rule literals. Every kernel this processor can run is measured, with memchr()
+ * as reference for single byte.
+ *
+ * Usage: bench_scan [file] [iterations]
+ */
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/hi_scan.h"
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static char *load_file(const char *path, int *len) {
+	FILE *f = fopen(path, "rb");
+	if(!f) return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = (char*)malloc(*len + 1);
+	*len = fread(buf, 1, *len, f);
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/* find every byte of the set, the way HiLiteral::scan() skips to the next token */
+static long find_all(int (*fn)(const HiByteSet*, const char*, int), const HiByteSet *set, const char *text, int len) {
+	long n = 0;
+
+	for(int i = fn(set, text, len); i < len; i += 1 + fn(set, text + i + 1, len - i - 1))
+		n++;
+
+	return n;
+}
+
+static long find_all_memchr(char c, const char *text, int len) {
+	long n = 0;
+
+	for(const char *p = text; (p = (const char*)memchr(p, c, (text + len) - p)) != NULL; p++)
+		n++;
+
+	return n;
+}
+
+static double gbs(int len, int iterations, double t) {
+	return (double)len * iterations / t / 1e9;
+}
+
+int main(int argc, char **argv) {
+	const char *path = (argc > 1) ? argv[1] : "src/Fl_Highlight_Editor.cxx";
+	int iterations = (argc > 2) ? atoi(argv[2]) : 200;
+	int len, i, j, k;
+	double t;
+	long n, expect;
+
+	char *text = load_file(path, &len);
+	if(!text) {
+		printf("Unable to load %s\n", path);
+		return 1;
+	}
+
+	/* one, a few and the most bytes searched with vector compares */
+	const char *sets[] = { "#", "/*\"", "/*\"'#<>@" };
+	const int nsets = sizeof(sets) / sizeof(sets[0]);
+	HiByteSet set[nsets];
+
+	for(i = 0; i < nsets; i++) {
+		for(const char *p = sets[i]; *p; p++)
+			set[i].add(*p);
+	}
+
+	const HiScanKernel *kernels;
+	int nkernels = hi_scan_kernels(&kernels);
+
+	printf("%s: %d bytes, %d iterations, using %s\n\n", path, len, iterations, kernels[0].name);
+	printf("%-24s", "(GB/s)");
+	for(k = 0; k < nkernels; k++)
+		printf(" %10s", kernels[k].name);
+	printf(" %10s\n", "memchr");
+
+	/* newlines */
+	printf("%-24s", "count lines");
+	for(k = 0, expect = -1; k < nkernels; k++) {
+		t = now();
+		for(j = 0, n = 0; j < iterations; j++)
+			n += kernels[k].count_lines(text, len);
+		printf(" %10.2f", gbs(len, iterations, now() - t));
+
+		if(expect != -1 && n != expect) printf(" (wrong: %ld)", n);
+		expect = n;
+	}
+
+	t = now();
+	for(j = 0, n = 0; j < iterations; j++)
+		n += find_all_memchr('\n', text, len);
+	printf(" %10.2f", gbs(len, iterations, now() - t));
+	printf(n != expect ? " (wrong: %ld)\n" : "\n", n);
+
+	/* sets of bytes */
+	for(i = 0; i < nsets; i++) {
+		char label[64];
+		snprintf(label, sizeof(label), "find %d byte(s) '%s'", set[i].nbytes, sets[i]);
+		printf("%-24s", label);
+
+		for(k = 0, expect = -1; k < nkernels; k++) {
+			t = now();
+			for(j = 0, n = 0; j < iterations; j++)
+				n += find_all(kernels[k].bytes, &set[i], text, len);
+			printf(" %10.2f", gbs(len, iterations, now() - t));
+
+			if(expect != -1 && n != expect) printf(" (wrong: %ld)", n);
+			expect = n;
+		}
+
+		if(set[i].nbytes == 1) {
+			t = now();
+			for(j = 0, n = 0; j < iterations; j++)
+				n += find_all_memchr(sets[i][0], text, len);
+			printf(" %10.2f", gbs(len, iterations, now() - t));
+			printf(n != expect ? " (wrong: %ld)\n" : "\n", n);
+		} else {
+			printf(" %10s\n", "-");
+		}
+	}
+
+	free(text);
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Time highlighting of the whole file at once (what is done when *editor-idle-highlight-budget* is 0) with different
+ * number of threads and check the result is the same as with a single thread.
+ *
+ * Usage: bench_threads [file] [max-threads] [iterations]
+ */
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+
+#include "FL/Fl_Highlight_Editor.H"
+
+/* style buffer is needed for comparison */
+class Bench_Editor : public Fl_Highlight_Editor {
+public:
+	Bench_Editor() : Fl_Highlight_Editor(0, 0, 400, 400) { }
+	char *styles(void) { return mStyleBuffer ? mStyleBuffer->text() : NULL; }
+};
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv) {
+	const char *path = (argc > 1) ? argv[1] : "src/Fl_Highlight_Editor.cxx";
+	int max_threads  = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int iterations   = (argc > 3) ? atoi(argv[3]) : 5;
+	char cmd[128], *reference, *styles;
+	double t, best, single = 0;
+
+	Bench_Editor *editor = new Bench_Editor();
+	editor->init_interpreter("./scheme");
+	editor->load_script_string("(set! *editor-idle-highlight-budget* 0)");
+	/* rule stopped over its budget paints different text with every number of threads */
+	editor->load_script_string("(set! *editor-rule-budget* 0)");
+
+	if(editor->loadfile(path) != 0) {
+		printf("Unable to load %s\n", path);
+		return 1;
+	}
+
+	reference = NULL;
+	printf("\n%s: %d bytes\n\n", path, editor->buffer()->length());
+	printf("%8s %12s %10s %10s\n", "threads", "time (ms)", "speedup", "same");
+
+	/* 1, 2, 4, ... and max_threads */
+	for(int n = 1; n <= max_threads; n = (n < max_threads && n * 2 > max_threads) ? max_threads : n * 2) {
+		snprintf(cmd, sizeof(cmd), "(set! *editor-parallel-highlight* %i)", n);
+		editor->load_script_string(cmd);
+
+		best = 0;
+		for(int i = 0; i < iterations; i++) {
+			t = now();
+			/* without flags, only style buffer is recreated */
+			editor->repaint(0);
+			t = now() - t;
+
+			if(i == 0 || t < best) best = t;
+		}
+
+		if(n == 1) single = best;
+
+		styles = editor->styles();
+		if(!reference) reference = strdup(styles);
+
+		printf("%8i %12.2f %10.2f %10s\n", n, best * 1e3, single / best, strcmp(reference, styles) == 0 ? "yes" : "NO");
+		free(styles);
+	}
+
+	free(reference);
+	delete editor;
+	return 0;
+}
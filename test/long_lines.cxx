@@ -0,0 +1,91 @@
+/*
+ * Edit around a line longer than *editor-max-line-length* and check that styles after every edit are the same as
+ * when the whole text is highlighted again. Edits before the line change the state it starts in (block comment is
+ * opened and closed), so the line and those after it have to be re-highlighted whole.
+ *
+ * Usage: long_lines [line-length]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+
+#include "FL/Fl_Highlight_Editor.H"
+
+#define MAX_LINE_LENGTH 1024
+
+/* short line, the long one and a short line after it, as C code */
+static bool write_text(const char *path, int len) {
+	FILE *f = fopen(path, "w");
+	if(!f) return false;
+
+	fputs("int a;\n", f);
+	for(int i = 0; i < len; i += 7)
+		fputs("x = 1; ", f);
+	fputs("\nint b;\n", f);
+
+	fclose(f);
+	return true;
+}
+
+/* compare styles with those after the whole text is highlighted again */
+static void check(Fl_Highlight_Editor *editor, const char *what) {
+	editor->load_script_string("(define *test-edited* (editor-dump-style-buffer))");
+	editor->repaint(0);
+
+	printf("%-40s ", what);
+	fflush(stdout);
+	editor->load_script_string("(display (if (string=? *test-edited* (editor-dump-style-buffer)) \"yes\" \"NO\"))");
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	const char *path = "/tmp/fl_highlight_long_lines.c";
+	int len          = (argc > 1) ? atoi(argv[1]) : 64 * 1024;
+	char cmd[128];
+
+	if(!write_text(path, len)) {
+		printf("Unable to write %s\n", path);
+		return 1;
+	}
+
+	Fl_Highlight_Editor *editor = new Fl_Highlight_Editor(0, 0, 400, 400);
+	editor->init_interpreter("./scheme");
+	/* re-highlight everything on every edit, so nothing is left for idle callback */
+	editor->load_script_string("(set! *editor-idle-highlight-budget* 0)");
+
+	snprintf(cmd, sizeof(cmd), "(set! *editor-max-line-length* %i)", MAX_LINE_LENGTH);
+	editor->load_script_string(cmd);
+
+	if(editor->loadfile(path) != 0) {
+		printf("Unable to load %s\n", path);
+		return 1;
+	}
+
+	Fl_Text_Buffer *buf = editor->buffer();
+	int long_start = buf->line_end(0) + 1;
+
+	printf("\n%s: %d bytes, line of %d bytes\n\n", path, buf->length(), buf->line_end(long_start) - long_start);
+	printf("%-40s %s\n", "edit", "same");
+
+	buf->insert(0, "/*");
+	check(editor, "block opened before the line");
+
+	buf->remove(0, 2);
+	check(editor, "block closed before the line");
+
+	buf->insert(long_start + len / 2, "x");
+	check(editor, "character typed inside the line");
+
+	buf->insert(long_start - 1, "/*");
+	check(editor, "block opened at the end of line before");
+
+	buf->remove(long_start - 1, long_start + 1);
+	check(editor, "block removed at the end of line before");
+
+	delete editor;
+	remove(path);
+	return 0;
+}